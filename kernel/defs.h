@@ -2,12 +2,14 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
@@ -24,6 +26,11 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
+
+// fdt.c
+extern uint64   fdtaddr;
+void            fdtinit(void);
 
 // file.c
 struct file*    filealloc(void);
@@ -64,6 +71,40 @@ void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
 uint64          getfreemem(void);
+void*           kalloc_zeroed(void);
+int             kzero_refill(void);
+int             kreserve(uint64);
+void            kunreserve(uint64);
+void            kref(void *);
+int             krefcount(void *);
+int             ktryref(void *);
+void*           kalloc_pages(int);
+void            kfree_pages(void *, int);
+void            kref_pages(void *, int);
+void            ksplit(void *, int);
+int             kwhole(void *, int);
+void            getfreeblocks(uint64 *);
+
+// mmap.c
+void            mmapinit(void);
+void            cpagedrop(struct inode*);
+void            cpagewrite(struct inode*, uint, char*, uint, uint64);
+uint64          mmap(struct file*, uint64, int, int, uint64);
+int             munmap(uint64, uint64);
+int             vmaimage(struct proc*, uint64, uint64, int, struct inode*, uint64);
+uint64          vmatrim(struct proc*, uint64);
+void            vmaunmapall(struct proc*);
+struct vma*     vmafind(struct proc*, uint64);
+int             vmafault(struct proc*, uint64, int);
+int             vmacopy(struct proc*, struct proc*);
+uint64          vmalow(struct proc*);
+
+// slab.c
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            kmem_cache_reserve(struct kmem_cache*, int);
+int             kmem_cache_reap(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -72,6 +113,7 @@ void            begin_op(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -86,11 +128,16 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, struct file**);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+int             setaffinity(int, uint64);
+int             schedtick(void);
+int             nice(int);
+int             settickets(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
 struct cpu*     mycpu(void);
@@ -101,8 +148,10 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(char *, void (*)(void));
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeone(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
@@ -139,6 +188,22 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// ksm.c
+void            ksminit(void);
+void            ksmforget(void *);
+void            ksmref(void *, int);
+int             ksmprivate(void *);
+void            getksmstats(uint64 *, uint64 *);
+
+// swap.c
+void            swapinit(void);
+uint64          swapfreepages(void);
+void            swapdup(pte_t);
+void            swapfree(pte_t);
+int             swapin(pagetable_t, uint64, pte_t *);
+int             swapreclaim(void);
+void            getswapstats(uint64 *, uint64 *);
+
 // syscall.c
 void            argint(int, int*);
 int             argstr(int, char*, int);
@@ -153,6 +218,7 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            tickwait(uint);
 
 // uart.c
 void            uartinit(void);
@@ -164,17 +230,28 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+void            asidinit(void);
+uint64          uvmsatp(struct proc *);
+void            uvmflush(pagetable_t);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
+uint64          uvmzero(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
+int             uvmprealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
+uint64          uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmdemote(pagetable_t, uint64);
+void            getsuperstats(uint64 *, uint64 *);
+int             uvmfault(pagetable_t, uint64, int);
+void            uvmprefault(pagetable_t, uint64, uint64, int);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walklevel(pagetable_t, uint64, int, int *);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -6,9 +6,20 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "fcntl.h"
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
 
+#define NLAZYSEG 4  // read-only segments exec() can map lazily
+
+// A read-only program segment to be mapped by vmaimage().
+struct lazyseg {
+  uint64 va;
+  uint64 len;
+  int prot;
+  uint64 off;
+};
+
 int flags2perm(int flags)
 {
     int perm = 0;
@@ -21,6 +32,15 @@ int flags2perm(int flags)
 
 int
 exec(char *path, char **argv)
+{
+  return execproc(myproc(), path, argv);
+}
+
+// Replace p's user image with the program at path.
+// p is either the current process or, for spawn(),
+// a new process that isn't running yet.
+int
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -29,7 +49,11 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+  struct lazyseg seg[NLAZYSEG];
+  struct inode *segip = 0;
+  int nseg = 0;
+  uint64 nzero = 0;
+  int reserved = 0;
 
   begin_op();
 
@@ -61,18 +85,48 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
-      goto bad;
-    sz = sz1;
+    if((ph.flags & ELF_PROG_FLAG_WRITE) == 0 && ph.filesz == ph.memsz &&
+       ph.off % PGSIZE == 0 && ph.vaddr == PGROUNDUP(sz) && nseg < NLAZYSEG){
+      // read-only: map it after committing to the image, and
+      // let vmafault() load and share its pages on demand.
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].len = ph.memsz;
+      seg[nseg].prot = PROT_READ | (ph.flags & ELF_PROG_FLAG_EXEC ? PROT_EXEC : 0);
+      seg[nseg].off = ph.off;
+      nseg++;
+      sz = ph.vaddr + ph.memsz;
+      continue;
+    }
+    uint64 sz1, end = ph.vaddr + ph.memsz;
+    if(ph.flags & ELF_PROG_FLAG_WRITE){
+      // only the pages with file contents need memory now;
+      // the BSS pages after them share the zero page until
+      // they are written, and are reserved below.
+      end = ph.vaddr + ph.filesz;
+    }
+    if(end > sz){
+      if((sz1 = uvmalloc(pagetable, sz, end, flags2perm(ph.flags))) == 0)
+        goto bad;
+      sz = sz1;
+    }
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
+    if(ph.vaddr + ph.memsz > sz){
+      if((sz1 = uvmzero(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+        goto bad;
+      nzero += (PGROUNDUP(sz1) - PGROUNDUP(sz)) / PGSIZE;
+      sz = sz1;
+    }
   }
+  if(kreserve(nzero) < 0)
+    goto bad;
+  reserved = 1;
+  if(nseg > 0)
+    segip = idup(ip);
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
@@ -121,9 +175,22 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  vmaunmapall(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  p->tlbflush = 1; // the TLB may still hold the old image under p->asid
   p->sz = sz;
+  for(i = 0; i < nseg; i++){
+    if(vmaimage(p, seg[i].va, seg[i].len, seg[i].prot, segip, seg[i].off) < 0)
+      panic("exec: vmaimage");
+  }
+  if(segip){
+    begin_op();
+    iput(segip);
+    end_op();
+  }
+  kunreserve(p->nreserved);
+  p->nreserved = nzero;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
@@ -133,10 +200,17 @@ exec(char *path, char **argv)
  bad:
   if(pagetable)
     proc_freepagetable(pagetable, sz);
+  if(reserved)
+    kunreserve(nzero);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(segip){
+    begin_op();
+    iput(segip);
+    end_op();
+  }
   return -1;
 }
 
@@ -0,0 +1,135 @@
+//
+// Find the size of RAM in the flattened device tree (DTB)
+// that qemu's boot ROM passes to the kernel in a1.
+//
+// The tree is a sequence of big-endian 32-bit tokens: a
+// node starts with FDT_BEGIN_NODE and its name, holds
+// FDT_PROP properties (a length, the offset of the name in
+// the strings block, and the value) and child nodes, and ends
+// with FDT_END_NODE. RAM is described by the "reg" property of
+// the top-level "memory@..." node, a list of (address, size)
+// pairs whose sizes in 32-bit cells the root node's
+// "#address-cells" and "#size-cells" give.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define FDT_MAGIC      0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE   2
+#define FDT_PROP       3
+#define FDT_NOP        4
+#define FDT_END        9
+
+struct fdthdr {
+  uint magic;
+  uint totalsize;
+  uint off_dt_struct;
+  uint off_dt_strings;
+  uint off_mem_rsvmap;
+  uint version;
+  uint last_comp_version;
+  uint boot_cpuid_phys;
+  uint size_dt_strings;
+  uint size_dt_struct;
+};
+
+// the DTB's physical address, set by start().
+uint64 fdtaddr;
+
+// the end of the RAM the kernel uses. see memlayout.h.
+uint64 phystop = KERNBASE + 128*1024*1024;
+
+static uint
+be32(void *p)
+{
+  uchar *b = p;
+
+  return ((uint)b[0] << 24) | ((uint)b[1] << 16) | ((uint)b[2] << 8) | b[3];
+}
+
+// read a number made of n big-endian 32-bit cells.
+static uint64
+cells(uint *p, int n)
+{
+  uint64 x = 0;
+
+  for(int i = 0; i < n; i++)
+    x = (x << 32) | be32(&p[i]);
+  return x;
+}
+
+// Return the end of the RAM that starts at KERNBASE,
+// according to the device tree at fdt, or 0 if the tree
+// is missing or doesn't say.
+static uint64
+memtop(char *fdt)
+{
+  struct fdthdr *h = (struct fdthdr *)fdt;
+  uint *p, *end, tok, len;
+  char *strings, *name;
+  int depth = 0, acells = 2, scells = 2, inmem = 0;
+  uint64 top = 0, base, size;
+
+  if(be32(&h->magic) != FDT_MAGIC)
+    return 0;
+  p = (uint*)(fdt + be32(&h->off_dt_struct));
+  end = (uint*)((char*)p + be32(&h->size_dt_struct));
+  strings = fdt + be32(&h->off_dt_strings);
+
+  while(p < end){
+    tok = be32(p++);
+    if(tok == FDT_BEGIN_NODE){
+      name = (char*)p;
+      depth++;
+      inmem = depth == 2 && strncmp(name, "memory", 6) == 0 &&
+              (name[6] == '@' || name[6] == '\0');
+      p += (strlen(name) + 1 + 3) / 4;
+    } else if(tok == FDT_END_NODE){
+      depth--;
+      inmem = 0;
+    } else if(tok == FDT_PROP){
+      len = be32(p++);
+      name = strings + be32(p++);
+      if(depth == 1 && strncmp(name, "#address-cells", 15) == 0)
+        acells = be32(p);
+      else if(depth == 1 && strncmp(name, "#size-cells", 12) == 0)
+        scells = be32(p);
+      else if(inmem && strncmp(name, "reg", 4) == 0){
+        for(uint *r = p; (char*)(r + acells + scells) <= (char*)p + len;
+            r += acells + scells){
+          base = cells(r, acells);
+          size = cells(r + acells, scells);
+          if(base <= KERNBASE && KERNBASE < base + size)
+            top = base + size;
+        }
+      }
+      p += (len + 3) / 4;
+    } else if(tok == FDT_NOP){
+      continue;
+    } else {
+      break; // FDT_END, or something unexpected
+    }
+  }
+  return top;
+}
+
+// Set PHYSTOP from the device tree, before kinit() hands
+// out any memory (the tree itself is near the top of RAM).
+// Keeps the default of 128 megabytes if there is no tree.
+void
+fdtinit(void)
+{
+  uint64 top = 0;
+
+  if(fdtaddr)
+    top = memtop((char*)fdtaddr);
+  if(top > PHYSMAX)
+    top = PHYSMAX;
+  if(top > KERNBASE)
+    phystop = PGROUNDDOWN(top);
+}
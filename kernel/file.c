@@ -14,15 +14,21 @@
 #include "proc.h"
 
 struct devsw devsw[NDEV];
+
+// file structures come from a slab cache; ftable.lock
+// protects their reference counts and the count of
+// allocated files, which is limited to NFILE.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache *cache;
+  int nfile;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file), 0);
 }
 
 // Allocate a file structure.
@@ -32,15 +38,22 @@ filealloc(void)
   struct file *f;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(ftable.nfile >= NFILE){
+    release(&ftable.lock);
+    return 0;
   }
+  ftable.nfile++;
   release(&ftable.lock);
-  return 0;
+
+  if((f = kmem_cache_alloc(ftable.cache)) == 0){
+    acquire(&ftable.lock);
+    ftable.nfile--;
+    release(&ftable.lock);
+    return 0;
+  }
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -71,7 +84,9 @@ fileclose(struct file *f)
   ff = *f;
   f->ref = 0;
   f->type = FD_NONE;
+  ftable.nfile--;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -118,6 +133,8 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
+    if(n > 0)
+      uvmprefault(myproc()->pagetable, addr, n, 1);
     ilock(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
@@ -154,6 +171,8 @@ filewrite(struct file *f, uint64 addr, int n)
     // might be writing a device like the console.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
+    if(n > 0)
+      uvmprefault(myproc()->pagetable, addr, n, 0);
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
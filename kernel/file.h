@@ -18,6 +18,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // next in itable hash chain
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -27,6 +28,7 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+  struct cpage *pages; // cached file pages; see mmap.c
 };
 
 // map major device number to device functions.
@@ -129,12 +129,13 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: the inode table is a hash table,
+//   keyed by dev and inum, of in-memory inodes allocated
+//   from a slab cache. ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds or creates a table entry and
+//   increments its ref; iput() decrements ref, and removes
+//   and frees the entry when ref reaches zero.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
@@ -164,29 +165,44 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The itable.lock spin-lock protects the hash chains and the
+// allocation of itable entries. Since ip->ref indicates whether
+// an entry is in use, and ip->dev and ip->inum indicate which
+// i-node an entry holds, one must hold itable.lock while using
+// any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 31
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  int ninode;              // entries in the table, at most NINODE
+  struct kmem_cache *cache;
 } itable;
 
+#define IHASH(dev, inum) (((dev) * 7 + (inum)) % NIHASH)
+
+static void
+inodector(void *obj)
+{
+  struct inode *ip = obj;
+
+  initsleeplock(&ip->lock, "inode");
+  ip->pages = 0;
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.cache = kmem_cache_create("inode", sizeof(struct inode), inodector);
+  // so that iget() can't fail for lack of memory, which a
+  // user can run out of.
+  kmem_cache_reserve(itable.cache, NINODE);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -246,31 +262,32 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  struct inode **bucket = &itable.hash[IHASH(dev, inum)];
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = *bucket; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Allocate a new inode entry. The cache holds NINODE
+  // inodes in reserve, so only the table limit can fail.
+  if(itable.ninode >= NINODE || (ip = kmem_cache_alloc(itable.cache)) == 0)
     panic("iget: no inodes");
+  itable.ninode++;
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = *bucket;
+  *bucket = ip;
   release(&itable.lock);
 
   return ip;
@@ -327,8 +344,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry is
+// removed and freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -358,6 +375,21 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0){
+    struct inode **pp = &itable.hash[IHASH(ip->dev, ip->inum)];
+    while(*pp != ip)
+      pp = &(*pp)->hnext;
+    *pp = ip->hnext;
+    release(&itable.lock);
+    cpagedrop(ip);
+    kmem_cache_free(itable.cache, ip);
+    // only now, so that iget() never counts on an inode
+    // that hasn't been freed yet.
+    acquire(&itable.lock);
+    itable.ninode--;
+    release(&itable.lock);
+    return;
+  }
   release(&itable.lock);
 }
 
@@ -429,6 +461,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  cpagedrop(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -523,6 +556,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    // keep cached pages of the file up to date.
+    cpagewrite(ip, off, (char*)bp->data + (off % BSIZE), m, user_src ? 0 : src);
     log_write(bp);
     brelse(bp);
   }
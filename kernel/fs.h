@@ -7,7 +7,12 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                         free bit map | data blocks | swap area ]
+//
+// The swap area (see swap.c) is outside the file system proper;
+// it holds NSWAP pages from block SWAPSTART on.
+#define SWAPSTART FSSIZE
+#define SWAPBLOCKS (NSWAP * (4096 / BSIZE))
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -1,6 +1,27 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and slabs of small kernel objects (see slab.c).
+//
+// Memory is managed by a binary buddy allocator, which hands
+// out naturally aligned blocks of 2^order pages and coalesces
+// a freed block with its buddy whenever both are free.
+//
+// Single pages, by far the most common request, are served
+// from per-CPU free lists that sit in front of the buddy
+// allocator, so that kalloc() and kfree() on different CPUs
+// don't contend. A CPU's list is refilled from (and drained
+// back to) the buddy allocator in batches; if the buddy
+// allocator is empty too, a CPU steals a batch of pages
+// from another CPU's list. As a last resort, kalloc() asks
+// the slab allocator to give back the pages it is caching.
+//
+// Idle CPUs keep a pool of already-zeroed pages topped up
+// (see kzero_refill()), so that kalloc_zeroed() usually
+// needn't clear a page on the caller's critical path.
+//
+// Build with KALLOC_JUNK=1 to fill pages with junk on
+// kalloc() and kfree(), to catch uses of uninitialized
+// or freed memory.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +30,27 @@
 #include "riscv.h"
 #include "defs.h"
 
+// max number of pages moved by one steal.
+#define KSTEAL_BATCH 64
+
+// pages moved between a per-CPU list and the buddy allocator
+// at a time, and the per-CPU list length that triggers a drain.
+#define KBATCH 32
+#define KHIGH  (4*KBATCH)
+
+// max pages in the zero pool, and pages zeroed per kzero_refill().
+#define NZERO       256
+#define KZERO_BATCH 8
+
+// pgorder[] value for a page that does not start a free buddy block.
+#define NOTFREE 0xff
+// pgorder[] flag for the first page of a block handed out whole
+// by kalloc_pages(), whose pages share one reference count.
+#define WHOLE 0x80
+
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PGI(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -16,50 +58,376 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;   // buddy free lists only
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;          // number of pages on freelist
+};
+
+struct kmem kmem[NCPU];
+
+struct {
+  struct spinlock lock;
+  struct run *freelist[MAXORDER+1];
+  int nblk[MAXORDER+1];  // number of free blocks of each order
+  int npages;            // total pages in free blocks
+} buddy;
+
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} kzero;
+
+// pages promised to lazily allocated user memory (see
+// growproc()) but not yet allocated. kreserve() won't
+// promise more than is free, and getfreemem() doesn't
+// count promised pages as free.
+struct {
+  struct spinlock lock;
+  uint64 npages;
+} kresv;
+
+// for each physical page, the order of the free buddy
+// block that starts there, WHOLE plus the order of the
+// allocated block that starts there, or NOTFREE.
+// protected by buddy.lock. kinit() places it, and pgref[],
+// at the start of free memory, sized for PHYSTOP.
+uchar *pgorder;
+
+// for each allocated physical page (or the first page of an
+// allocated block), the number of references to it. kalloc()
+// sets it to one, kref() adds one, and kfree() only frees the
+// page once the count drops to zero. updated atomically, so
+// that copy-on-write pages can be shared without a lock.
+int *pgref;
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&buddy.lock, "buddy");
+  initlock(&kzero.lock, "kzero");
+  initlock(&kresv.lock, "kresv");
+
+  char *p = end;
+  pgorder = (uchar*)p;
+  p += NPAGE * sizeof(pgorder[0]);
+  pgref = (int*)(((uint64)p + sizeof(int) - 1) & ~(sizeof(int) - 1));
+  p = (char*)(pgref + NPAGE);
+  memset(pgorder, NOTFREE, NPAGE * sizeof(pgorder[0]));
+  memset(pgref, 0, NPAGE * sizeof(pgref[0]));
+  freerange(p, (void*)PHYSTOP);
 }
 
+static void buddy_free(uint64 pa, int order);
+
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
+  acquire(&buddy.lock);
   for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+    buddy_free((uint64)p, 0);
+  release(&buddy.lock);
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Buddy allocator. Caller must hold buddy.lock.
+
+static void
+buddy_push(uint64 pa, int order)
+{
+  struct run *r = (struct run*)pa;
+
+  r->prev = 0;
+  r->next = buddy.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  buddy.freelist[order] = r;
+  buddy.nblk[order]++;
+  buddy.npages += 1 << order;
+  pgorder[PA2PGI(pa)] = order;
+}
+
+static void
+buddy_remove(uint64 pa, int order)
+{
+  struct run *r = (struct run*)pa;
+
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    buddy.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  buddy.nblk[order]--;
+  buddy.npages -= 1 << order;
+  pgorder[PA2PGI(pa)] = NOTFREE;
+}
+
+// Return the smallest free block of at least 2^order pages,
+// split down to exactly 2^order pages, or 0.
+static uint64
+buddy_alloc(int order)
+{
+  uint64 pa;
+  int o;
+
+  for(o = order; o <= MAXORDER; o++)
+    if(buddy.freelist[o])
+      break;
+  if(o > MAXORDER)
+    return 0;
+
+  pa = (uint64)buddy.freelist[o];
+  buddy_remove(pa, o);
+  while(o > order){
+    o--;
+    buddy_push(pa + ((uint64)PGSIZE << o), o);
+  }
+  return pa;
+}
+
+// Free the 2^order page block at pa, merging it with its
+// buddy for as long as the buddy is free as well.
+static void
+buddy_free(uint64 pa, int order)
+{
+  uint64 bpa;
+
+  while(order < MAXORDER){
+    bpa = KERNBASE + ((pa - KERNBASE) ^ ((uint64)PGSIZE << order));
+    if(bpa >= PHYSTOP || pgorder[PA2PGI(bpa)] != order)
+      break;
+    buddy_remove(bpa, order);
+    if(bpa < pa)
+      pa = bpa;
+    order++;
+  }
+  buddy_push(pa, order);
+}
+
+// Per-CPU page lists.
+
+// Give n pages from the list of CPU id back to the buddy
+// allocator. Interrupts must be disabled.
+static void
+kdrain(int id, int n)
+{
+  struct run *r, *next;
+  struct kmem *km = &kmem[id];
+  int i;
+
+  acquire(&km->lock);
+  if(n > km->nfree)
+    n = km->nfree;
+  r = km->freelist;
+  for(i = 0; i < n; i++)
+    km->freelist = km->freelist->next;
+  km->nfree -= n;
+  release(&km->lock);
+
+  acquire(&buddy.lock);
+  for(i = 0; i < n; i++){
+    next = r->next;
+    buddy_free((uint64)r, 0);
+    r = next;
+  }
+  release(&buddy.lock);
+}
+
+// Move up to KBATCH pages from the buddy allocator to the
+// list of CPU id, and return one more page for the caller.
+// Returns 0 if the buddy allocator is empty.
+// Interrupts must be disabled.
+static struct run *
+krefill(int id)
+{
+  struct run *head = 0, *r;
+  uint64 pa;
+  int n;
+
+  acquire(&buddy.lock);
+  for(n = 0; n <= KBATCH; n++){
+    if((pa = buddy_alloc(0)) == 0)
+      break;
+    r = (struct run*)pa;
+    r->next = head;
+    head = r;
+  }
+  release(&buddy.lock);
+
+  if(head == 0)
+    return 0;
+  r = head;
+  if(n > 1){
+    struct run *tail = head->next;
+    while(tail->next)
+      tail = tail->next;
+    acquire(&kmem[id].lock);
+    tail->next = kmem[id].freelist;
+    kmem[id].freelist = head->next;
+    kmem[id].nfree += n - 1;
+    release(&kmem[id].lock);
+  }
+  return r;
+}
+
+// Take up to half of another CPU's free pages (at most
+// KSTEAL_BATCH) and move them to CPU id's list.
+// Returns one of the stolen pages, or 0 if every other
+// list is empty. Only one kmem lock is held at a time.
+// Interrupts must be disabled.
+static struct run *
+ksteal(int id)
+{
+  struct run *head, *tail, *r;
+  struct kmem *victim;
+  int i, n, want;
+
+  for(i = 1; i < NCPU; i++){
+    victim = &kmem[(id + i) % NCPU];
+    acquire(&victim->lock);
+    if(victim->nfree == 0){
+      release(&victim->lock);
+      continue;
+    }
+    want = (victim->nfree + 1) / 2;
+    if(want > KSTEAL_BATCH)
+      want = KSTEAL_BATCH;
+    head = tail = victim->freelist;
+    for(n = 1; n < want; n++)
+      tail = tail->next;
+    victim->freelist = tail->next;
+    victim->nfree -= want;
+    release(&victim->lock);
+
+    // keep the first page for the caller, and
+    // stash the rest on our own list.
+    r = head;
+    if(want > 1){
+      acquire(&kmem[id].lock);
+      tail->next = kmem[id].freelist;
+      kmem[id].freelist = head->next;
+      kmem[id].nfree += want - 1;
+      release(&kmem[id].lock);
+    }
+    return r;
+  }
+  return 0;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
 void
 kfree(void *pa)
 {
   struct run *r;
+  struct kmem *km;
+  int id, drain, ref;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  ref = __sync_sub_and_fetch(&pgref[PA2PGI(pa)], 1);
+  if(ref > 0){
+    ksmref(pa, -1);
+    return;
+  }
+  if(ref < 0)
+    panic("kfree: ref");
+  ksmforget(pa);
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  km = &kmem[id];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  drain = km->nfree >= KHIGH;
+  release(&km->lock);
+  if(drain)
+    kdrain(id, KBATCH);
+  pop_off();
+}
+
+// Take a page from this CPU's list, refilling it from the
+// buddy allocator or from other CPUs if it is empty.
+static struct run *
+kget(void)
+{
+  struct run *r;
+  struct kmem *km;
+  int id;
+
+  push_off();
+  id = cpuid();
+  km = &kmem[id];
+  acquire(&km->lock);
+  r = km->freelist;
+  if(r){
+    km->freelist = r->next;
+    km->nfree--;
+  }
+  release(&km->lock);
+  if(r == 0)
+    r = krefill(id);
+  if(r == 0)
+    r = ksteal(id);
+  pop_off();
+  return r;
+}
+
+// Take a page from the zero pool, or return 0 if it is empty.
+static struct run *
+kzero_get(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.list;
+  if(r){
+    kzero.list = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+  if(r)
+    r->next = 0; // the link was the page's only non-zero word
+  return r;
+}
+
+// Give every page in the zero pool back to the buddy allocator.
+static void
+kzero_drain(void)
+{
+  struct run *r, *next;
+
+  acquire(&kzero.lock);
+  r = kzero.list;
+  kzero.list = 0;
+  kzero.n = 0;
+  release(&kzero.lock);
+
+  acquire(&buddy.lock);
+  for(; r; r = next){
+    next = r->next;
+    buddy_free((uint64)r, 0);
+  }
+  release(&buddy.lock);
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,25 +438,293 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
+  r = kget();
+  if(r == 0)
+    r = kzero_get();
+  if(r == 0 && kmem_cache_reap() > 0)
+    r = kget(); // objects cached by the slab allocator freed some pages
   if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+    pgref[PA2PGI(r)] = 1;
 
+#ifdef KALLOC_JUNK
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
 
+// Allocate one zero-filled page of physical memory,
+// preferably from the pool of pages zeroed by idle CPUs.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  if((r = kzero_get()) != 0){
+    pgref[PA2PGI(r)] = 1;
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Zero a few free pages and add them to the zero pool,
+// unless it is already full. Called by idle CPUs from
+// scheduler(), with interrupts enabled. Returns the
+// number of pages zeroed.
+int
+kzero_refill(void)
+{
+  struct run *r;
+  int i;
+
+  for(i = 0; i < KZERO_BATCH; i++){
+    if(__atomic_load_n(&kzero.n, __ATOMIC_RELAXED) >= NZERO)
+      break;
+    if((r = kget()) == 0)
+      break;
+    memset((char*)r, 0, PGSIZE);
+    acquire(&kzero.lock);
+    r->next = kzero.list;
+    kzero.list = r;
+    kzero.n++;
+    release(&kzero.lock);
+  }
+  return i;
+}
+
+// Allocate a physically contiguous, naturally aligned block
+// of 2^order pages. Returns 0 if no such block is free.
+void *
+kalloc_pages(int order)
+{
+  uint64 pa;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+
+  acquire(&buddy.lock);
+  pa = buddy_alloc(order);
+  if(pa)
+    pgorder[PA2PGI(pa)] = WHOLE | order;
+  release(&buddy.lock);
+
+  if(pa == 0){
+    // pages parked on the per-CPU lists or in slab
+    // caches may be what keeps a large enough block
+    // from forming.
+    kmem_cache_reap();
+    kzero_drain();
+    push_off();
+    for(int i = 0; i < NCPU; i++)
+      kdrain(i, NPAGE);
+    pop_off();
+    acquire(&buddy.lock);
+    pa = buddy_alloc(order);
+    if(pa)
+      pgorder[PA2PGI(pa)] = WHOLE | order;
+    release(&buddy.lock);
+  }
+
+  if(pa)
+    pgref[PA2PGI(pa)] = 1;
+#ifdef KALLOC_JUNK
+  if(pa)
+    memset((char*)pa, 5, (uint64)PGSIZE << order); // fill with junk
+#endif
+  return (void*)pa;
+}
+
+// Drop a reference to a block returned by kalloc_pages(order),
+// and free it if that was the last one. If the block has been
+// split by ksplit(), drop a reference to each of its pages.
+void
+kfree_pages(void *pa, int order)
+{
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order > MAXORDER ||
+     (((uint64)pa - KERNBASE) % ((uint64)PGSIZE << order)) != 0 ||
+     (char*)pa < end || (uint64)pa + ((uint64)PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+
+  acquire(&buddy.lock);
+  if(pgorder[PA2PGI(pa)] != (WHOLE | order)){
+    release(&buddy.lock);
+    for(uint64 i = 0; i < (1L << order); i++)
+      kfree((char*)pa + i*PGSIZE);
+    return;
+  }
+  if(__sync_sub_and_fetch(&pgref[PA2PGI(pa)], 1) > 0){
+    release(&buddy.lock);
+    return;
+  }
+
+#ifdef KALLOC_JUNK
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, (uint64)PGSIZE << order);
+#endif
+
+  pgorder[PA2PGI(pa)] = NOTFREE;
+  buddy_free((uint64)pa, order);
+  release(&buddy.lock);
+}
+
+// Add a reference to a block returned by kalloc_pages(order),
+// or to each of its pages if it has been split.
+void
+kref_pages(void *pa, int order)
+{
+  acquire(&buddy.lock);
+  if(pgorder[PA2PGI(pa)] == (WHOLE | order)){
+    __sync_fetch_and_add(&pgref[PA2PGI(pa)], 1);
+  } else {
+    for(uint64 i = 0; i < (1L << order); i++)
+      kref((char*)pa + i*PGSIZE);
+  }
+  release(&buddy.lock);
+}
+
+// Turn a block returned by kalloc_pages(order) into 2^order
+// pages that can be referenced and freed one at a time with
+// kref() and kfree(), each starting with the block's count
+// of references. Does nothing if the block is already split.
+void
+ksplit(void *pa, int order)
+{
+  int ref;
+
+  acquire(&buddy.lock);
+  if(pgorder[PA2PGI(pa)] == (WHOLE | order)){
+    ref = pgref[PA2PGI(pa)];
+    for(uint64 i = 1; i < (1L << order); i++)
+      pgref[PA2PGI(pa) + i] = ref;
+    pgorder[PA2PGI(pa)] = NOTFREE;
+  }
+  release(&buddy.lock);
+}
+
+// Return 1 if the block of 2^order pages at pa is still whole,
+// that is, was returned by kalloc_pages(order) and not split.
+int
+kwhole(void *pa, int order)
+{
+  int r;
+
+  acquire(&buddy.lock);
+  r = pgorder[PA2PGI(pa)] == (WHOLE | order);
+  release(&buddy.lock);
+  return r;
+}
+
+// Add a reference to the allocated page (or block) at pa.
+void
+kref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
+  __sync_fetch_and_add(&pgref[PA2PGI(pa)], 1);
+  ksmref(pa, 1);
+}
+
+// Add a reference to the page at pa, unless its last
+// reference has been dropped and it is being freed.
+// Returns 1 if it added one, 0 if not.
+int
+ktryref(void *pa)
+{
+  int *ref = &pgref[PA2PGI(pa)], n;
+
+  while((n = __atomic_load_n(ref, __ATOMIC_RELAXED)) > 0){
+    if(__sync_bool_compare_and_swap(ref, n, n + 1))
+      return 1;
+  }
+  return 0;
+}
+
+// Return the number of references to the page at pa.
+int
+krefcount(void *pa)
+{
+  return __atomic_load_n(&pgref[PA2PGI(pa)], __ATOMIC_RELAXED);
+}
+
+// Return the number of free pages.
+static uint64
+kfreepages(void)
+{
+  uint64 npages = 0;
+
+  for(int i = 0; i < NCPU; i++)
+    npages += __atomic_load_n(&kmem[i].nfree, __ATOMIC_RELAXED);
+  npages += __atomic_load_n(&buddy.npages, __ATOMIC_RELAXED);
+  npages += __atomic_load_n(&kzero.n, __ATOMIC_RELAXED);
+  return npages;
+}
+
+// Promise npages pages to lazily allocated user memory.
+// Returns 0, or -1 if fewer than npages free pages
+// are left unpromised. Free swap slots count as free
+// pages, since swapping out a page frees one.
+// This is admission control only: kalloc() doesn't set
+// promised pages aside, so a promised page can still
+// fail to materialize if the kernel uses up memory.
+int
+kreserve(uint64 npages)
+{
+  int r = -1;
+
+  acquire(&kresv.lock);
+  if(kresv.npages + npages <= kfreepages() + swapfreepages()){
+    kresv.npages += npages;
+    r = 0;
+  }
+  release(&kresv.lock);
+  return r;
+}
+
+// Withdraw a promise made by kreserve(), either because the
+// memory was given up or because it has now been allocated.
+void
+kunreserve(uint64 npages)
+{
+  acquire(&kresv.lock);
+  if(npages > kresv.npages)
+    panic("kunreserve");
+  kresv.npages -= npages;
+  release(&kresv.lock);
+}
+
+// Return the number of free bytes, counting free swap slots,
+// that haven't been promised to lazily allocated user memory.
+// Sums the per-CPU counters, the buddy allocator's and the
+// zero pool's counts without taking any lock, so the result
+// is a snapshot that may be slightly stale while other CPUs
+// are allocating.
 uint64
 getfreemem(void)
 {
-  uint64 bytes = 0;
-  acquire(&kmem.lock);
-  for (struct run *r = kmem.freelist; r; r = r->next) {
-    bytes += PGSIZE;
-  }
-  release(&kmem.lock);
-  return bytes;
-}
\ No newline at end of file
+  uint64 npages = kfreepages() + swapfreepages();
+  uint64 resv = __atomic_load_n(&kresv.npages, __ATOMIC_RELAXED);
+
+  if(resv > npages)
+    return 0;
+  return (npages - resv) * PGSIZE;
+}
+
+// Report the number of free buddy blocks of each order
+// 0..MAXORDER in nblk[], for watching fragmentation.
+// Pages on the per-CPU lists are not included.
+// Takes no lock, like getfreemem().
+void
+getfreeblocks(uint64 *nblk)
+{
+  for(int o = 0; o <= MAXORDER; o++)
+    nblk[o] = __atomic_load_n(&buddy.nblk[o], __ATOMIC_RELAXED);
+}
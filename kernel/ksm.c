@@ -0,0 +1,329 @@
+//
+// Kernel same-page merging.
+//
+// A kernel thread, ksmd, slowly sweeps over the processes'
+// private anonymous pages, looking for pages with the same
+// contents, and merges them into one shared copy-on-write
+// page, so that a write to it through any of its mappings
+// takes a page fault and gets a private copy again (see
+// uvmcow()).
+//
+// Merged pages are kept in the stable table, hashed by
+// contents. A page that matches no stable page is recorded
+// in the unstable table, which lasts one sweep. When a later
+// page matches an unstable one, the later page becomes a
+// stable page, and the earlier one is merged into it when the
+// sweep comes round to it again.
+//
+// A page is only looked at if it hasn't been written since
+// the last sweep (its PTE_D is clear), so that pages that
+// are being written aren't merged only to be copied again.
+//
+// Like swapping, merging changes the physical page behind a
+// user address, so it skips processes that are running or
+// that were preempted in kernel mode.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define KSMHASH   64    // hash buckets in each table
+#define NKSM      512   // stable and unstable entries
+#define KSMSCAN   256   // pages looked at per wakeup
+#define KSMSLEEP  10    // ticks between wakeups
+
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PGI(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+extern struct proc proc[NPROC];
+
+struct ksmpage {
+  uint hash;
+  uint64 pa;
+  struct ksmpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct ksmpage page[NKSM];
+  struct ksmpage *free;
+  struct ksmpage *stable[KSMHASH];
+  struct ksmpage *unstable[KSMHASH];
+  uint64 nmerged;
+  uint64 nsaved;  // references to stable pages beyond their first
+} ksm;
+
+// for each physical page, is it in the stable table?
+// set and cleared with ksm.lock held. sized for PHYSTOP
+// by ksminit().
+uchar *isstable;
+
+// the sweep's position: the next page to look at is va
+// of proc[hand]. used only by ksmd.
+struct {
+  int hand;
+  uint64 va;
+} sweep;
+
+static void ksmd(void);
+
+void
+ksminit(void)
+{
+  int o;
+
+  initlock(&ksm.lock, "ksm");
+  for(o = 0; ((uint64)PGSIZE << o) < NPAGE; o++)
+    ;
+  if(o > MAXORDER || (isstable = kalloc_pages(o)) == 0)
+    panic("ksminit");
+  memset(isstable, 0, NPAGE);
+  for(int i = 0; i < NKSM; i++){
+    ksm.page[i].next = ksm.free;
+    ksm.free = &ksm.page[i];
+  }
+  kthread("ksmd", ksmd);
+}
+
+static uint
+pagehash(char *pa)
+{
+  uint64 *w = (uint64*)pa, h = 0;
+
+  for(int i = 0; i < PGSIZE / 8; i++)
+    h = (h ^ w[i]) * 0x100000001b3L;
+  return h ^ (h >> 32);
+}
+
+// Find a page in table t whose contents are those of pa.
+// Caller must hold ksm.lock.
+static struct ksmpage *
+lookup(struct ksmpage **t, uint hash, char *pa)
+{
+  struct ksmpage *e;
+
+  for(e = t[hash % KSMHASH]; e; e = e->next){
+    if(e->hash == hash && e->pa != (uint64)pa &&
+       memcmp((char*)e->pa, pa, PGSIZE) == 0)
+      return e;
+  }
+  return 0;
+}
+
+// Remove entry e from table t. Caller must hold ksm.lock.
+static void
+unlink(struct ksmpage **t, struct ksmpage *e)
+{
+  struct ksmpage **pp;
+
+  for(pp = &t[e->hash % KSMHASH]; *pp != e; pp = &(*pp)->next)
+    ;
+  *pp = e->next;
+  e->next = ksm.free;
+  ksm.free = e;
+}
+
+// Add pa to table t, if there is room.
+// Caller must hold ksm.lock.
+static struct ksmpage *
+insert(struct ksmpage **t, uint hash, char *pa)
+{
+  struct ksmpage *e;
+
+  if((e = ksm.free) == 0)
+    return 0;
+  ksm.free = e->next;
+  e->hash = hash;
+  e->pa = (uint64)pa;
+  e->next = t[hash % KSMHASH];
+  t[hash % KSMHASH] = e;
+  return e;
+}
+
+// Remove the stable page pa from the stable table.
+// Caller must hold ksm.lock.
+static void
+dropstable(char *pa)
+{
+  struct ksmpage *e;
+
+  for(int i = 0; i < KSMHASH; i++){
+    for(e = ksm.stable[i]; e; e = e->next){
+      if(e->pa == (uint64)pa){
+        unlink(ksm.stable, e);
+        isstable[PA2PGI(pa)] = 0;
+        return;
+      }
+    }
+  }
+  panic("dropstable");
+}
+
+// Called by kfree() when the last reference to the page
+// at pa is dropped, before the page is reused.
+void
+ksmforget(void *pa)
+{
+  if(!isstable[PA2PGI(pa)])
+    return;
+  acquire(&ksm.lock);
+  dropstable(pa);
+  release(&ksm.lock);
+}
+
+// Called by kref() when it adds a reference to the page at
+// pa (n is 1), and by kfree() when it drops one that isn't
+// the last (n is -1), to keep ksm.nsaved up to date without
+// a lock.
+void
+ksmref(void *pa, int n)
+{
+  if(isstable[PA2PGI(pa)])
+    __sync_fetch_and_add(&ksm.nsaved, n);
+}
+
+// Called by uvmcow() before it lets the only mapping of the
+// copy-on-write page at pa write it in place. Returns 1 if
+// it may, or 0 if pa is a stable page that may be merged
+// with at any moment, so that it must be copied instead.
+int
+ksmprivate(void *pa)
+{
+  int r = 1;
+
+  if(!isstable[PA2PGI(pa)])
+    return 1;
+  acquire(&ksm.lock);
+  if(krefcount(pa) == 1)
+    dropstable(pa);
+  else
+    r = 0;
+  release(&ksm.lock);
+  return r;
+}
+
+// Look at the page that *pte maps at va of p, which the
+// caller has locked, and merge it if it can be.
+static void
+scan(struct proc *p, uint64 va, pte_t *pte)
+{
+  char *pa = (char*)PTE2PA(*pte), *into = 0;
+  struct ksmpage *e;
+  uint hash;
+  int promote = 0;
+
+  // mapped pages are never merged; leave their PTE_D alone,
+  // since vmawriteback() needs it.
+  if((*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W) || vmafind(p, va))
+    return;
+  if(*pte & PTE_D){
+    // written since the last sweep; wait until it settles.
+    *pte &= ~PTE_D;
+    p->tlbflush = 1;
+    return;
+  }
+  if(krefcount(pa) != 1 || isstable[PA2PGI(pa)])
+    return;
+
+  hash = pagehash(pa);
+  acquire(&ksm.lock);
+  if((e = lookup(ksm.stable, hash, pa)) != 0 && ktryref((void*)e->pa)){
+    into = (char*)e->pa;
+    ksm.nmerged++;
+    __sync_fetch_and_add(&ksm.nsaved, 1);
+  } else if((e = lookup(ksm.unstable, hash, pa)) != 0){
+    if(insert(ksm.stable, hash, pa)){
+      isstable[PA2PGI(pa)] = 1;
+      unlink(ksm.unstable, e);
+      promote = 1;
+    }
+  } else {
+    insert(ksm.unstable, hash, pa);
+  }
+  release(&ksm.lock);
+
+  if(into){
+    *pte = PA2PTE(into) | ((PTE_FLAGS(*pte) & ~PTE_W) | PTE_COW);
+    p->tlbflush = 1;
+    kfree(pa);
+  } else if(promote){
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+    p->tlbflush = 1;
+  }
+}
+
+// Sweep over up to KSMSCAN pages.
+static void
+ksmscan(void)
+{
+  struct proc *p;
+  pte_t *pte;
+  int level, n = 0, done;
+
+  while(n < KSMSCAN){
+    p = &proc[sweep.hand];
+    acquire(&p->lock);
+    done = 1;
+    if(p->state != UNUSED && p->state != USED && p->state != ZOMBIE &&
+       p->state != RUNNING && !p->kyield){
+      for(done = 0; n < KSMSCAN; sweep.va += PGSIZE, n++){
+        if(sweep.va >= p->sz){
+          done = 1;
+          break;
+        }
+        level = 0;
+        pte = walklevel(p->pagetable, sweep.va, 0, &level);
+        // superpages and swapped-out pages are left alone.
+        if(pte && level == 0)
+          scan(p, sweep.va, pte);
+      }
+    }
+    release(&p->lock);
+    if(!done)
+      break;
+
+    sweep.va = 0;
+    if(++sweep.hand == NPROC){
+      // a new sweep: forget the pages seen in the last one.
+      sweep.hand = 0;
+      acquire(&ksm.lock);
+      for(int i = 0; i < KSMHASH; i++){
+        while(ksm.unstable[i])
+          unlink(ksm.unstable, ksm.unstable[i]);
+      }
+      release(&ksm.lock);
+      break;
+    }
+    n++;
+  }
+}
+
+static void
+ksmd(void)
+{
+  uint ticks0;
+
+  for(;;){
+    ksmscan();
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < KSMSLEEP)
+      tickwait(ticks0 + KSMSLEEP);
+    release(&tickslock);
+  }
+}
+
+// Report the number of pages merged so far, and the bytes
+// that the stable pages would take up if each of their
+// mappings had its own copy. Takes no lock.
+void
+getksmstats(uint64 *merged, uint64 *saved)
+{
+  *merged = __atomic_load_n(&ksm.nmerged, __ATOMIC_RELAXED);
+  *saved = __atomic_load_n(&ksm.nsaved, __ATOMIC_RELAXED) * PGSIZE;
+}
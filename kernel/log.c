@@ -135,6 +135,9 @@ begin_op(void)
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      // pass the wakeup on, if there is room for another op.
+      if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS <= LOGSIZE)
+        wakeone(&log);
       release(&log.lock);
       break;
     }
@@ -158,8 +161,8 @@ end_op(void)
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+    // the amount of reserved space, by enough for one op.
+    wakeone(&log);
   }
   release(&log.lock);
 
@@ -169,7 +172,9 @@ end_op(void)
     commit();
     acquire(&log.lock);
     log.committing = 0;
-    wakeup(&log);
+    // wake one begin_op(), which wakes the next, and so on
+    // while there is room, rather than all of them at once.
+    wakeone(&log);
     release(&log.lock);
   }
 }
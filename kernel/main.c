@@ -16,9 +16,11 @@ main()
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
+    fdtinit();       // size of RAM, from the device tree
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // address-space IDs
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
@@ -27,8 +29,12 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    mmapinit();      // file page cache
     virtio_disk_init(); // emulated hard disk
+    swapinit();      // swap area
     userinit();      // first user process
+    ksminit();       // same-page merging thread
     __sync_synchronize();
     started = 1;
   } else {
@@ -15,7 +15,7 @@
 // the kernel uses physical memory thus:
 // 80000000 -- entry.S, then kernel text and data
 // end -- start of kernel page allocation area
-// PHYSTOP -- end RAM used by the kernel
+// PHYSTOP -- end RAM used by the kernel (the end of RAM)
 
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
@@ -29,6 +29,7 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt.
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -43,9 +44,15 @@
 
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
-// from physical address 0x80000000 to PHYSTOP.
+// from physical address 0x80000000 to PHYSTOP,
+// which fdtinit() reads from the device tree at boot,
+// up to at most PHYSMAX.
 #define KERNBASE 0x80000000L
-#define PHYSTOP (KERNBASE + 128*1024*1024)
+#define PHYSMAX (KERNBASE + 16L*1024*1024*1024)
+#ifndef __ASSEMBLER__
+extern uint64 phystop;
+#endif
+#define PHYSTOP phystop
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
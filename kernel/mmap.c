@@ -0,0 +1,633 @@
+//
+// Memory-mapped files and anonymous memory.
+//
+// A process has up to NVMA mappings, recorded in p->vma[].
+// mmap() only records a mapping; vmafault() allocates each
+// page, and reads it from the file, on first access.
+// Mappings are placed top-down below TRAPFRAME, and the
+// heap is not allowed to grow into them.
+//
+// MAP_PRIVATE pages belong to the process: writes never
+// reach the file, and fork() shares them copy-on-write.
+// MAP_SHARED pages of a file are the pages of the file's
+// page cache (see below), so every process that maps the
+// file shared sees the same copy, whether it faulted the
+// page in before or after a fork(). Pages marked dirty
+// (PTE_D, by the hardware or by copyout()) are written back
+// to the file through the log by munmap() and exit(). MAP_SHARED anonymous pages
+// are kept in an anonymous object, which fork() shares, so
+// that a page first touched after fork() is still shared.
+//
+// exec() maps read-only program segments the same way, as
+// VMA_IMAGE mappings inside the process image (below p->sz).
+//
+// Pages of read-only and shared file mappings come from a
+// small page cache hanging off the inode (ip->pages), so
+// processes running the same program share one copy of its
+// text. The cache holds a reference to each page. A write to
+// the file updates the cached pages that shared mappings use,
+// and drops the others; the cache is emptied when the file is
+// truncated, and when the inode leaves the inode table.
+//
+// p->vma[] is private to the process, so no lock is needed.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+// A cached page of a file, or a page of an anonymous object.
+struct cpage {
+  struct cpage *next;  // on ip->pages or a->pages
+  uint64 off;          // offset, page-aligned
+  int shared;          // mapped by a MAP_SHARED mapping?
+  char *pa;
+};
+
+// The pages of a MAP_SHARED anonymous mapping, shared by
+// the mappings that fork() and munmap() make of it.
+struct anon {
+  struct spinlock lock;
+  int ref;             // mappings that refer to it
+  struct cpage *pages;
+};
+
+struct kmem_cache *cpagecache;
+struct kmem_cache *anoncache;
+
+void
+mmapinit(void)
+{
+  cpagecache = kmem_cache_create("cpage", sizeof(struct cpage), 0);
+  anoncache = kmem_cache_create("anon", sizeof(struct anon), 0);
+}
+
+// Return the cached page of ip at file offset off (page-
+// aligned), reading it in if necessary, with a reference
+// for the caller. For a shared mapping, the page must be
+// cached, and may be past the end of the file (it is zero
+// there); otherwise it need not be, and may not be.
+// Returns 0 if off is past the end of the file and !shared,
+// or if out of memory.
+// Caller must hold ip->lock.
+static char*
+cpageget(struct inode *ip, uint64 off, int shared)
+{
+  struct cpage *cp;
+  char *mem;
+
+  if(off >= ip->size && !shared)
+    return 0;
+  for(cp = ip->pages; cp; cp = cp->next){
+    if(cp->off == off){
+      cp->shared |= shared;
+      kref(cp->pa);
+      return cp->pa;
+    }
+  }
+
+  if((mem = kalloc_zeroed()) == 0)
+    return 0;
+  if(off < ip->size)
+    readi(ip, 0, (uint64)mem, off, PGSIZE);
+  if((cp = kmem_cache_alloc(cpagecache)) != 0){
+    cp->off = off;
+    cp->shared = shared;
+    cp->pa = mem;
+    cp->next = ip->pages;
+    ip->pages = cp;
+    kref(mem);
+  } else if(shared){
+    kfree(mem);
+    return 0;
+  }
+  return mem;
+}
+
+// Called by writei() after it writes the n bytes at data
+// to ip at file offset off, which lie within one page: copy
+// them into the cached page, if a shared mapping uses it,
+// or else drop the page, which is now stale. src is the
+// kernel address writei() copied from, or 0.
+// Caller must hold ip->lock.
+void
+cpagewrite(struct inode *ip, uint off, char *data, uint n, uint64 src)
+{
+  struct cpage **pp, *cp;
+  char *dst;
+
+  for(pp = &ip->pages; (cp = *pp) != 0; pp = &cp->next){
+    if(cp->off != PGROUNDDOWN(off))
+      continue;
+    dst = cp->pa + off % PGSIZE;
+    if(!cp->shared){
+      *pp = cp->next;
+      kfree(cp->pa);
+      kmem_cache_free(cpagecache, cp);
+    } else if((uint64)dst != src){
+      // (not when writing the page back to the file, since
+      // a mapping may have changed it again meanwhile.)
+      memmove(dst, data, n);
+    }
+    return;
+  }
+}
+
+// Empty ip's page cache. Pages stay mapped wherever
+// they are mapped, but new faults will read the file.
+// Caller must hold ip->lock, or hold the last reference.
+void
+cpagedrop(struct inode *ip)
+{
+  struct cpage *cp;
+
+  while((cp = ip->pages) != 0){
+    ip->pages = cp->next;
+    kfree(cp->pa);
+    kmem_cache_free(cpagecache, cp);
+  }
+}
+
+// Make an empty anonymous object, with one reference.
+static struct anon*
+anonalloc(void)
+{
+  struct anon *a;
+
+  if((a = kmem_cache_alloc(anoncache)) == 0)
+    return 0;
+  initlock(&a->lock, "anon");
+  a->ref = 1;
+  a->pages = 0;
+  return a;
+}
+
+static void
+anondup(struct anon *a)
+{
+  acquire(&a->lock);
+  a->ref++;
+  release(&a->lock);
+}
+
+// Drop a reference to a, freeing it and its pages
+// with the last one.
+static void
+anonput(struct anon *a)
+{
+  struct cpage *cp;
+  int ref;
+
+  acquire(&a->lock);
+  ref = --a->ref;
+  release(&a->lock);
+  if(ref > 0)
+    return;
+  while((cp = a->pages) != 0){
+    a->pages = cp->next;
+    kfree(cp->pa);
+    kmem_cache_free(cpagecache, cp);
+  }
+  kmem_cache_free(anoncache, a);
+}
+
+// Return a's page at offset off, allocating a zeroed one if
+// it has none, with a reference for the caller.
+// Returns 0 if out of memory.
+static char*
+anonget(struct anon *a, uint64 off)
+{
+  struct cpage *cp;
+  char *mem = 0;
+
+  acquire(&a->lock);
+  for(cp = a->pages; cp; cp = cp->next){
+    if(cp->off == off){
+      mem = cp->pa;
+      break;
+    }
+  }
+  if(mem == 0 && (mem = kalloc_zeroed()) != 0){
+    if((cp = kmem_cache_alloc(cpagecache)) == 0){
+      kfree(mem);
+      mem = 0;
+    } else {
+      cp->off = off;
+      cp->shared = 1;
+      cp->pa = mem;
+      cp->next = a->pages;
+      a->pages = cp;
+    }
+  }
+  if(mem)
+    kref(mem);
+  release(&a->lock);
+  return mem;
+}
+
+// Return p's mapping that contains va, or 0.
+struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end != 0 && v->start <= va && va < v->end)
+      return v;
+  }
+  return 0;
+}
+
+// Return an unused slot in p->vma[], or 0.
+static struct vma*
+vmaalloc(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end == 0)
+      return v;
+  }
+  return 0;
+}
+
+// Return the lowest address used by p's mmap()ed memory,
+// which is as far as the heap may grow.
+uint64
+vmalow(struct proc *p)
+{
+  struct vma *v;
+  uint64 low = TRAPFRAME;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end != 0 && (v->flags & VMA_IMAGE) == 0 && v->start < low)
+      low = v->start;
+  }
+  return low;
+}
+
+// Find the highest free range of len bytes (a multiple
+// of PGSIZE) above p's heap. Returns its start, or 0.
+static uint64
+vmaplace(struct proc *p, uint64 len)
+{
+  struct vma *v;
+  uint64 start;
+
+  if(len > TRAPFRAME)
+    return 0;
+  start = TRAPFRAME - len;
+ again:
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end != 0 && v->start < start + len && start < v->end){
+      if(v->start < len)
+        return 0;
+      start = v->start - len;
+      goto again;
+    }
+  }
+  if(start < PGROUNDUP(p->sz))
+    return 0;
+  return start;
+}
+
+// Map len bytes of f, starting at file offset off, into the
+// current process; if f is 0, map zero-filled anonymous memory.
+// Returns the address of the mapping, or -1.
+uint64
+mmap(struct file *f, uint64 len, int prot, int flags, uint64 off)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 start;
+  int share = flags & (MAP_SHARED|MAP_PRIVATE);
+
+  if(len == 0 || len > TRAPFRAME || (off % PGSIZE) != 0)
+    return -1;
+  if(share != MAP_SHARED && share != MAP_PRIVATE)
+    return -1;
+  if(flags & VMA_IMAGE)
+    return -1;
+  if(f){
+    if(f->type != FD_INODE || f->readable == 0)
+      return -1;
+    if(share == MAP_SHARED && (prot & PROT_WRITE) && f->writable == 0)
+      return -1;
+  }
+
+  len = PGROUNDUP(len);
+  if((v = vmaalloc(p)) == 0 || (start = vmaplace(p, len)) == 0)
+    return -1;
+  v->anon = 0;
+  if(f == 0 && share == MAP_SHARED && (v->anon = anonalloc()) == 0)
+    return -1;
+  v->start = start;
+  v->end = start + len;
+  v->prot = prot;
+  v->flags = flags;
+  v->ip = f ? idup(f->ip) : 0;
+  v->off = off;
+  return start;
+}
+
+// Add a mapping of len bytes of ip at file offset off to
+// p's image at va, for exec(). va and off must be page-aligned.
+// Returns 0, or -1 if p has no free slot.
+int
+vmaimage(struct proc *p, uint64 va, uint64 len, int prot, struct inode *ip, uint64 off)
+{
+  struct vma *v;
+
+  if((v = vmaalloc(p)) == 0)
+    return -1;
+  v->start = va;
+  v->end = va + PGROUNDUP(len);
+  v->prot = prot;
+  v->flags = MAP_PRIVATE | VMA_IMAGE;
+  v->ip = idup(ip);
+  v->anon = 0;
+  v->off = off;
+  return 0;
+}
+
+// If the process has written page va of mapping v, and v is a
+// shared file mapping, write the page back to the file.
+// Only the part of the page inside the file is written, so
+// a mapping never extends the file.
+static void
+vmawriteback(struct proc *p, struct vma *v, uint64 va)
+{
+  // write a few blocks at a time, as filewrite() does.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  struct inode *ip;
+  pte_t *pte;
+  uint64 pa, off;
+  int i, n;
+
+  if(v->ip == 0 || (v->flags & MAP_SHARED) == 0)
+    return;
+  pte = walk(p->pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+    return;
+  ip = v->ip;
+  pa = PTE2PA(*pte);
+  off = v->off + (va - v->start);
+
+  for(i = 0; i < PGSIZE; i += n){
+    begin_op();
+    ilock(ip);
+    n = 0;
+    if(off + i < ip->size){
+      n = ip->size - (off + i);
+      if(n > PGSIZE - i)
+        n = PGSIZE - i;
+      if(n > max)
+        n = max;
+      n = writei(ip, 0, pa + i, off + i, n);
+    }
+    iunlock(ip);
+    end_op();
+    if(n <= 0)
+      break;
+  }
+  *pte &= ~PTE_D;
+  uvmflush(p->pagetable);
+}
+
+// Unmap the pages from start to end of mapping v, writing
+// back dirty shared pages, and shrink or free v.
+// The range must not be in the middle of v.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 a;
+
+  for(a = start; a < end; a += PGSIZE)
+    vmawriteback(p, v, a);
+  uvmunmap(p->pagetable, start, (end - start) / PGSIZE, 1);
+
+  if(start == v->start && end == v->end){
+    if(v->ip){
+      begin_op();
+      iput(v->ip);
+      end_op();
+    }
+    if(v->anon)
+      anonput(v->anon);
+    v->ip = 0;
+    v->anon = 0;
+    v->start = v->end = 0;
+  } else if(start == v->start){
+    v->off += end - start;
+    v->start = end;
+  } else {
+    v->end = start;
+  }
+}
+
+// Unmap the pages from va to va+len, which may cover all or
+// parts of several mappings, or none. The program image
+// can't be unmapped this way. Returns 0, or -1 if the
+// arguments are bad or a mapping would have to be split in
+// two and there is no free slot for the second half.
+int
+munmap(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+  uint64 start, end;
+
+  if((va % PGSIZE) != 0 || len == 0 || va >= TRAPFRAME || len > TRAPFRAME - va)
+    return -1;
+  end = PGROUNDUP(va + len);
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end == 0 || v->end <= va || v->start >= end)
+      continue;
+    if(v->flags & VMA_IMAGE)
+      continue;
+    start = va > v->start ? va : v->start;
+    if(start > v->start && end < v->end){
+      // a hole in the middle: move the part above the
+      // hole into a mapping of its own.
+      if((nv = vmaalloc(p)) == 0)
+        return -1;
+      *nv = *v;
+      nv->start = end;
+      nv->off += end - v->start;
+      if(nv->ip)
+        idup(nv->ip);
+      if(nv->anon)
+        anondup(nv->anon);
+      v->end = end;
+    }
+    vmaunmap(p, v, start, end < v->end ? end : v->end);
+  }
+  return 0;
+}
+
+// Unmap the parts of p's image mappings above sz, for a
+// shrinking growproc(). Returns the number of pages they
+// covered, mapped or not.
+uint64
+vmatrim(struct proc *p, uint64 sz)
+{
+  struct vma *v;
+  uint64 n = 0;
+
+  sz = PGROUNDUP(sz);
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end == 0 || (v->flags & VMA_IMAGE) == 0 || v->end <= sz)
+      continue;
+    if(v->start < sz){
+      n += (v->end - sz) / PGSIZE;
+      vmaunmap(p, v, sz, v->end);
+    } else {
+      n += (v->end - v->start) / PGSIZE;
+      vmaunmap(p, v, v->start, v->end);
+    }
+  }
+  return n;
+}
+
+// Unmap all of p's mappings, for exit() and exec().
+void
+vmaunmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end != 0)
+      vmaunmap(p, v, v->start, v->end);
+  }
+}
+
+// Handle a page fault at va in one of p's mappings.
+// Finds or allocates, and fills in, the page if the mapping
+// allows the access; a write to a private page shared by
+// fork() is passed to uvmcow().
+// Returns 0 if the access can now proceed, -1 if not.
+int
+vmafault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+  struct inode *ip;
+  pte_t *pte;
+  uint64 off;
+  char *mem;
+  int perm;
+
+  va = PGROUNDDOWN(va);
+  if((v = vmafind(p, va)) == 0)
+    return -1;
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+  if(!write && (v->prot & (PROT_READ|PROT_EXEC)) == 0)
+    return -1;
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(write)
+      return uvmcow(p->pagetable, va);
+    return -1;
+  }
+
+  mem = 0;
+  off = v->off + (va - v->start);
+  if(v->flags & MAP_SHARED){
+    // every mapping of the file, or of the anonymous
+    // object, maps the one copy of the page.
+    if((ip = v->ip) != 0){
+      ilock(ip);
+      mem = cpageget(ip, off, 1);
+      iunlock(ip);
+    } else {
+      mem = anonget(v->anon, off);
+    }
+    if(mem == 0)
+      return -1;
+  } else if((ip = v->ip) != 0){
+    ilock(ip);
+    if((v->prot & PROT_WRITE) == 0){
+      // never written, so the cached page can be shared.
+      if(off < ip->size && (mem = cpageget(ip, off, 0)) == 0){
+        iunlock(ip);
+        return -1;
+      }
+    } else if((mem = kalloc_zeroed()) != 0 && off < ip->size){
+      readi(ip, 0, (uint64)mem, off, PGSIZE);
+    }
+    iunlock(ip);
+  }
+  // anonymous memory, and pages past the end of the file,
+  // are zero.
+  if(mem == 0 && (mem = kalloc_zeroed()) == 0)
+    return -1;
+
+  perm = PTE_U | PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Give child np copies of p's mappings, for fork().
+// Pages already present are shared: MAP_SHARED pages stay
+// writable in both, MAP_PRIVATE pages become copy-on-write.
+// Returns 0, or -1 if out of memory, in which case np is
+// left without any mappings.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint64 a, pa;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    // uvmcopy() has already copied the image's pages.
+    if(v->end == 0 || (v->flags & VMA_IMAGE))
+      continue;
+    for(a = v->start; a < v->end; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if((v->flags & MAP_PRIVATE) && (*pte & PTE_W)){
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+        uvmflush(p->pagetable);
+      }
+      pa = PTE2PA(*pte);
+      // the parent's dirty pages are the parent's to write back.
+      if(mappages(np->pagetable, a, PGSIZE, pa, PTE_FLAGS(*pte) & ~PTE_D) != 0)
+        goto err;
+      kref((void*)pa);
+    }
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    np->vma[v - p->vma] = *v;
+    if(v->end != 0 && v->ip)
+      idup(v->ip);
+    if(v->end != 0 && v->anon)
+      anondup(v->anon);
+  }
+  return 0;
+
+ err:
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end != 0 && (v->flags & VMA_IMAGE) == 0)
+      uvmunmap(np->pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+  }
+  return -1;
+}
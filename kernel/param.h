@@ -11,3 +11,9 @@
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER     10    // largest buddy block is 2^MAXORDER pages
+#define NVMA         16    // memory mappings per process
+#define NSWAP        1024  // pages in the swap area on disk
+#define NICEMAX      19    // largest nice value
+#define DEFTICKETS   100   // stride scheduling tickets a process starts with
+#define MAXTICKETS   10000 // most tickets a process may have
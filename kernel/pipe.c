@@ -17,8 +17,25 @@ struct pipe {
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int reading;    // a reader is copying out bytes it hasn't consumed yet
 };
 
+struct kmem_cache *pipecache;
+
+static void
+pipector(void *obj)
+{
+  struct pipe *pi = obj;
+
+  initlock(&pi->lock, "pipe");
+}
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipe", sizeof(struct pipe), pipector);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,13 +45,13 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kmem_cache_alloc(pipecache)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
-  initlock(&pi->lock, "pipe");
+  pi->reading = 0;
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -47,7 +64,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmem_cache_free(pipecache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,63 +85,91 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kmem_cache_free(pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// Copy at most PIPESIZE bytes at a time from the user into
+// a buffer on the kernel stack, and from there into the pipe,
+// so that pi->lock is not held while copyin() runs: copyin()
+// may have to read the user's page back from swap.
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, j, m, bad = 0;
+  char buf[PIPESIZE];
   struct proc *pr = myproc();
 
-  acquire(&pi->lock);
-  while(i < n){
-    if(pi->readopen == 0 || killed(pr)){
-      release(&pi->lock);
-      return -1;
+  while(i < n && !bad){
+    m = n - i < PIPESIZE ? n - i : PIPESIZE;
+    if(copyin(pr->pagetable, buf, addr + i, m) == -1){
+      // write the bytes before the first one that can't be read.
+      for(j = 0; j < m && copyin(pr->pagetable, buf + j, addr + i + j, 1) == 0; j++)
+        ;
+      m = j;
+      bad = 1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+
+    acquire(&pi->lock);
+    for(j = 0; j < m; ){
+      if(pi->readopen == 0 || killed(pr)){
+        release(&pi->lock);
+        return -1;
+      }
+      if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
+      } else {
+        pi->data[pi->nwrite++ % PIPESIZE] = buf[j++];
+      }
     }
+    wakeup(&pi->nread);
+    release(&pi->lock);
+    i += m;
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
   return i;
 }
 
+// As with pipewrite(), copyout() runs without pi->lock.
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m;
+  char buf[PIPESIZE];
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->reading){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  // copy without consuming, so that the bytes stay in the pipe
+  // if copyout() fails; pi->reading keeps other readers off them.
+  for(m = 0; m < n && m < PIPESIZE; m++){  //DOC: piperead-copy
+    if(pi->nread + m == pi->nwrite)
       break;
+    buf[m] = pi->data[(pi->nread + m) % PIPESIZE];
   }
+  pi->reading = 1;
+  release(&pi->lock);
+
+  if(copyout(pr->pagetable, addr, buf, m) == -1){
+    // consume only the bytes before the first one that can't be written.
+    for(i = 0; i < m && copyout(pr->pagetable, addr + i, buf + i, 1) == 0; i++)
+      ;
+    m = i;
+  }
+
+  acquire(&pi->lock);
+  pi->nread += m;
+  pi->reading = 0;
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  wakeup(&pi->nread);   // other readers
   release(&pi->lock);
-  return i;
+  return m;
 }
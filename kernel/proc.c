@@ -8,6 +8,83 @@
 
 struct cpu cpus[NCPU];
 
+#if defined(SCHED_MLFQ)
+// Multi-level feedback queue (make SCHED=MLFQ): a process
+// starts at the level its nice value gives it, drops a level
+// each time it uses up its level's quantum of clock ticks
+// (counted whether or not it slept in between), and is boosted
+// back to its starting level every BOOSTTICKS ticks, whether it
+// is running or waiting on a run queue, so that CPU-bound
+// processes can't starve. A process that wakes at a
+// higher level than the running one preempts it at the next
+// tick.
+#define NPRIO 4
+static int quantum[NPRIO] = {1, 2, 4, 8};
+#define BOOSTTICKS 50
+#elif defined(SCHED_STRIDE)
+// Stride scheduling (make SCHED=STRIDE): each process has a
+// number of tickets, and a pass that goes up by STRIDE1 divided
+// by its tickets for each tick it is given. Each run queue is
+// a min-heap on pass, and a CPU runs the process with the
+// lowest pass, so processes on a CPU share it in proportion to
+// their tickets. A process that has been asleep rejoins at no
+// less than the run queue's current pass, so that it can't
+// save up a claim on the CPU while it sleeps.
+#define NPRIO 1
+#define STRIDE1 (1 << 20)
+#else
+// Round robin: one level, and every tick ends a process's turn.
+#define NPRIO 1
+#endif
+
+// Per-CPU queues of RUNNABLE processes: one FIFO per priority
+// level, or a heap under stride scheduling. A process is on
+// exactly one queue from the time it is made RUNNABLE until a
+// scheduler takes it off to run it; see setrunnable() and
+// scheduler(). A CPU whose queue is empty steals from the
+// longest other queue.
+// Lock order: p->lock, then a run queue's lock.
+struct runq
+{
+  struct spinlock lock;
+#ifdef SCHED_STRIDE
+  struct proc *heap[NPROC]; // min-heap on pass
+  uint64 pass;              // pass of the last process taken off
+#else
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+#ifdef SCHED_MLFQ
+  uint boost; // boost period its processes were last boosted in
+#endif
+#endif
+  int n; // length, read without the lock by pickcpu() and runqsteal()
+} runq[NCPU];
+
+// Wait queues of SLEEPING processes, hashed by the channel
+// they sleep on, in FIFO order. A process is on the queue of
+// its p->chan from the time sleep() marks it SLEEPING until
+// wakeup(), wakeone() or kill() takes it off to make it
+// RUNNABLE, so that a wakeup looks only at the processes in
+// one bucket, rather than at every process.
+// Lock order: a wait queue's lock, then p->lock.
+#define NWAITQ 64
+struct waitq
+{
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+} waitq[NWAITQ];
+
+#define WAITQ(chan) (&waitq[((uint64)(chan) * 0x9e3779b97f4a7c15L) >> 58])
+
+// mask of the CPUs that have entered scheduler().
+// updated atomically.
+uint64 cpuonline;
+
+// mask of the CPUs that are waiting for an interrupt in
+// idle(). updated atomically.
+uint64 cpuidle;
+
 struct proc proc[NPROC];
 
 struct proc *initproc;
@@ -15,8 +92,26 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// The processes that have pids, from allocproc() to
+// freeproc(), hashed by pid, so that kill() and setaffinity()
+// needn't scan proc[].
+// Lock order: p->lock, then pidhash.lock.
+#define NPIDHASH 64
+struct
+{
+  struct spinlock lock;
+  struct proc *head[NPIDHASH];
+} pidhash;
+
+// number of procs whose state is not UNUSED, not counting
+// kernel threads. updated atomically by allocproc() and freeproc()
+// so that getnproc() needn't scan proc[].
+int nliveproc;
+
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void setrunnable(struct proc *p);
+static int baseprio(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -49,7 +144,12 @@ void procinit(void)
   struct proc *p;
 
   initlock(&pid_lock, "nextpid");
+  initlock(&pidhash.lock, "pidhash");
   initlock(&wait_lock, "wait_lock");
+  for (int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for (int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for (p = proc; p < &proc[NPROC]; p++)
   {
     initlock(&p->lock, "proc");
@@ -102,10 +202,12 @@ int allocpid()
 
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. A kernel thread gets pid 0,
+// so that it takes no pid from user processes, and isn't
+// counted by getnproc().
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc *
-allocproc(void)
+allocproc(int kernel)
 {
   struct proc *p;
 
@@ -124,8 +226,26 @@ allocproc(void)
   return 0;
 
 found:
-  p->pid = allocpid();
+  if (!kernel)
+  {
+    p->pid = allocpid();
+    acquire(&pidhash.lock);
+    p->pidnext = pidhash.head[p->pid % NPIDHASH];
+    pidhash.head[p->pid % NPIDHASH] = p;
+    release(&pidhash.lock);
+    __sync_fetch_and_add(&nliveproc, 1);
+  }
+  p->kthread = 0;
+  p->children = 0;
+  p->sibling = 0;
   p->state = USED;
+  p->cpu = -1;
+  p->affinity = ~0L;
+  p->nice = 0;
+  p->prio = 0;
+  p->slice = 0;
+  p->tickets = DEFTICKETS;
+  p->pass = 0;
 
   // Allocate a trapframe page.
   if ((p->trapframe = (struct trapframe *)kalloc()) == 0)
@@ -166,6 +286,20 @@ freeproc(struct proc *p)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  kunreserve(p->nreserved);
+  p->nreserved = 0;
+  p->asidgen = 0; // the next user of this slot gets a fresh ASID
+  if (p->pid)
+  {
+    struct proc **pp;
+
+    acquire(&pidhash.lock);
+    for (pp = &pidhash.head[p->pid % NPIDHASH]; *pp != p; pp = &(*pp)->pidnext)
+      ;
+    *pp = p->pidnext;
+    release(&pidhash.lock);
+    __sync_fetch_and_sub(&nliveproc, 1);
+  }
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -237,7 +371,7 @@ void userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
 
   // allocate one user page and copy initcode's instructions
@@ -252,29 +386,81 @@ void userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
+
+  release(&p->lock);
+}
+
+// A kernel thread's first scheduling by scheduler()
+// will swtch to kthreadret.
+static void kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kthread();
+  panic("kthread returned");
+}
+
+// Start a kernel thread: a process without user memory that
+// runs fn() in the kernel and never returns to user space.
+void kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if ((p = allocproc(1)) == 0)
+    panic("kthread");
+  p->kthread = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  setrunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only reserves memory; pages are allocated
+// by uvmfault() when the process first touches them.
+// Shrinking frees only the pages that were touched.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
 {
-  uint64 sz;
+  uint64 sz, npages, nimage, nfreed;
   struct proc *p = myproc();
 
   sz = p->sz;
   if (n > 0)
   {
-    if ((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0)
-    {
+    if (sz + n > vmalow(p))
       return -1;
-    }
+    npages = (PGROUNDUP(sz + n) - PGROUNDUP(sz)) / PGSIZE;
+    if (npages > getfreemem() / PGSIZE)
+      return -1;
+    if (uvmprealloc(p->pagetable, sz, sz + n) < 0 &&
+        (swapreclaim() == 0 || uvmprealloc(p->pagetable, sz, sz + n) < 0))
+      return -1;
+    if (kreserve(npages) < 0)
+      return -1;
+    p->nreserved += npages;
+    sz += n;
   }
-  else if (n < 0)
+  else if (n < 0 && sz + n < sz)
   {
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // (if n would shrink past 0, sz + n wraps around
+    // and the size is left alone.)
+    // a superpage that the new end cuts through must be split.
+    if (PGROUNDUP(sz + n) % SUPERPGSIZE != 0 &&
+        uvmdemote(p->pagetable, PGROUNDUP(sz + n)) < 0)
+      return -1;
+    sz += n;
+    npages = (PGROUNDUP(p->sz) - PGROUNDUP(sz)) / PGSIZE;
+    // pages of lazily loaded program segments were never reserved.
+    nimage = vmatrim(p, sz);
+    nfreed = uvmunmap(p->pagetable, PGROUNDUP(sz), npages, 1);
+    kunreserve(npages - nimage - nfreed);
+    p->nreserved -= npages - nimage - nfreed;
   }
   p->sz = sz;
   return 0;
@@ -289,7 +475,7 @@ int fork(void)
   struct proc *p = myproc();
 
   // Allocate process.
-  if ((np = allocproc()) == 0)
+  if ((np = allocproc(0)) == 0)
   {
     return -1;
   }
@@ -302,8 +488,28 @@ int fork(void)
     return -1;
   }
   np->sz = p->sz;
+  // the child inherits the parent's untouched pages,
+  // so it needs its own reservation for them.
+  if (kreserve(p->nreserved) < 0)
+  {
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->nreserved = p->nreserved;
+  if (vmacopy(p, np) < 0)
+  {
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
   // (HW1-1) copy the trace mask from parent to child
   np->trace_mask = p->trace_mask;
+  np->affinity = p->affinity;
+  np->nice = p->nice;
+  np->prio = baseprio(np);
+  np->tickets = p->tickets;
+  np->pass = p->pass;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -325,10 +531,64 @@ int fork(void)
 
   acquire(&wait_lock);
   np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a new process running the program at path, without
+// copying the parent: the child's image is built directly from
+// the program file. The child takes over the references in
+// ofile[] as its open files, but only if spawn() succeeds.
+// Returns the child's pid, or -1.
+int spawn(char *path, char **argv, struct file **ofile)
+{
+  int i, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if ((np = allocproc(0)) == 0)
+    return -1;
+  // np isn't RUNNABLE, so nothing else will touch it, and
+  // exec must not hold a spinlock while it reads the file.
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if ((argc = execproc(np, path, argv)) < 0)
+  {
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+  np->trace_mask = p->trace_mask;
+  np->affinity = p->affinity;
+  np->nice = p->nice;
+  np->prio = baseprio(np);
+  np->tickets = p->tickets;
+  np->pass = p->pass;
+
+  for (i = 0; i < NOFILE; i++)
+    np->ofile[i] = ofile[i];
+  np->cwd = idup(p->cwd);
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  np->sibling = p->children;
+  p->children = np;
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -340,14 +600,18 @@ void reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for (pp = proc; pp < &proc[NPROC]; pp++)
+  if (p->children == 0)
+    return;
+  for (pp = p->children;; pp = pp->sibling)
   {
-    if (pp->parent == p)
-    {
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+    pp->parent = initproc;
+    if (pp->sibling == 0)
+      break;
   }
+  pp->sibling = initproc->children;
+  initproc->children = p->children;
+  p->children = 0;
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -360,6 +624,9 @@ void exit(int status)
   if (p == initproc)
     panic("init exiting");
 
+  // Unmap mmap()ed memory, writing back shared file pages.
+  vmaunmapall(p);
+
   // Close all open files.
   for (int fd = 0; fd < NOFILE; fd++)
   {
@@ -400,46 +667,55 @@ void exit(int status)
 // Return -1 if this process has no children.
 int wait(uint64 addr)
 {
-  struct proc *pp;
-  int havekids, pid;
+  struct proc *pp, *prev, *q;
+  int pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
 
   for (;;)
   {
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for (pp = proc; pp < &proc[NPROC]; pp++)
+    // Scan through the children looking for exited ones.
+    for (prev = 0, pp = p->children; pp; prev = pp, pp = pp->sibling)
     {
-      if (pp->parent == p)
-      {
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
 
-        havekids = 1;
-        if (pp->state == ZOMBIE)
+      if (pp->state == ZOMBIE)
+      {
+        // Found one. Copy out its status without the locks
+        // held, since copyout() may have to read the page
+        // back from swap. Only we reap our children, so it
+        // stays a zombie meanwhile; if the copy fails, it is
+        // left for another wait().
+        xstate = pp->xstate;
+        release(&pp->lock);
+        if (addr != 0)
         {
-          // Found one.
-          pid = pp->pid;
-          if (addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                   sizeof(pp->xstate)) < 0)
-          {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
-          release(&pp->lock);
           release(&wait_lock);
-          return pid;
+          if (copyout(p->pagetable, addr, (char *)&xstate, sizeof(xstate)) < 0)
+            return -1;
+          acquire(&wait_lock);
+          // init may have been given more children meanwhile.
+          for (prev = 0, q = p->children; q != pp; prev = q, q = q->sibling)
+            ;
         }
+        if (prev)
+          prev->sibling = pp->sibling;
+        else
+          p->children = pp->sibling;
+        acquire(&pp->lock);
+        pid = pp->pid;
+        freeproc(pp);
         release(&pp->lock);
+        release(&wait_lock);
+        return pid;
       }
+      release(&pp->lock);
     }
 
     // No point waiting if we don't have any children.
-    if (!havekids || killed(p))
+    if (p->children == 0 || killed(p))
     {
       release(&wait_lock);
       return -1;
@@ -450,10 +726,411 @@ int wait(uint64 addr)
   }
 }
 
+// Choose a run queue for p: the CPU it last ran on, if it may
+// still run there, or else the least loaded CPU that it may
+// run on. A new process starts out on the least loaded CPU.
+static int pickcpu(struct proc *p)
+{
+  uint64 ok = p->affinity & __atomic_load_n(&cpuonline, __ATOMIC_RELAXED);
+  int i, best = -1, n, bestn = 0;
+
+  if (ok == 0)
+    ok = 1; // before the other CPUs start, or a stale mask
+  if (p->cpu >= 0 && (ok & (1L << p->cpu)))
+    return p->cpu;
+  for (i = 0; i < NCPU; i++)
+  {
+    if ((ok & (1L << i)) == 0)
+      continue;
+    n = __atomic_load_n(&runq[i].n, __ATOMIC_RELAXED);
+    if (best < 0 || n < bestn)
+    {
+      best = i;
+      bestn = n;
+    }
+  }
+  return best;
+}
+
+// The run queue level that p starts at and is boosted to.
+static int baseprio(struct proc *p)
+{
+  return p->nice * NPRIO / (NICEMAX + 1);
+}
+
+#ifdef SCHED_MLFQ
+// Boost p to its starting level if a boost period has
+// begun since it was last boosted. Caller must hold p->lock.
+static void mlfqboost(struct proc *p)
+{
+  uint period = __atomic_load_n(&ticks, __ATOMIC_RELAXED) / BOOSTTICKS;
+
+  if (p->boost != period)
+  {
+    p->boost = period;
+    p->prio = baseprio(p);
+    p->slice = 0;
+  }
+}
+#endif
+
+#ifdef SCHED_STRIDE
+static void heapswap(struct proc **h, int i, int j)
+{
+  struct proc *t = h[i];
+
+  h[i] = h[j];
+  h[j] = t;
+}
+
+// Move h[i] up the heap to its place.
+static void heapup(struct proc **h, int i)
+{
+  for (; i > 0 && h[i]->pass < h[(i - 1) / 2]->pass; i = (i - 1) / 2)
+    heapswap(h, i, (i - 1) / 2);
+}
+
+// Move h[i] down the heap of n processes to its place.
+static void heapdown(struct proc **h, int n, int i)
+{
+  int c;
+
+  for (; (c = 2 * i + 1) < n; i = c)
+  {
+    if (c + 1 < n && h[c + 1]->pass < h[c]->pass)
+      c++;
+    if (h[i]->pass <= h[c]->pass)
+      break;
+    heapswap(h, i, c);
+  }
+}
+
+// Add p to rq. Caller must hold rq->lock.
+static void runqput(struct runq *rq, struct proc *p)
+{
+  if (p->pass < rq->pass)
+    p->pass = rq->pass;
+  rq->heap[rq->n] = p;
+  heapup(rq->heap, rq->n);
+  rq->n++;
+}
+
+// Take rq->heap[i] off rq. Caller must hold rq->lock.
+static void runqdel(struct runq *rq, int i)
+{
+  rq->n--;
+  rq->heap[i] = rq->heap[rq->n];
+  if (i < rq->n)
+  {
+    heapdown(rq->heap, rq->n, i);
+    heapup(rq->heap, i);
+  }
+}
+
+// Take the process with the lowest pass that may run on CPU
+// id off rq, or return 0 if there is none, and charge it for
+// the tick it is about to be given.
+static struct proc *runqget(struct runq *rq, int id)
+{
+  struct proc *p = 0;
+  int i, best = -1;
+
+  acquire(&rq->lock);
+  if (rq->n > 0 && (rq->heap[0]->affinity & (1L << id)))
+  {
+    best = 0;
+  }
+  else
+  {
+    // stealing, or the first isn't allowed here; look at all.
+    for (i = 0; i < rq->n; i++)
+      if ((rq->heap[i]->affinity & (1L << id)) &&
+          (best < 0 || rq->heap[i]->pass < rq->heap[best]->pass))
+        best = i;
+  }
+  if (best >= 0)
+  {
+    p = rq->heap[best];
+    runqdel(rq, best);
+    rq->pass = p->pass;
+    p->pass += STRIDE1 / p->tickets;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Whether rq holds a process that may run on CPU id.
+static int runqhas(struct runq *rq, int id)
+{
+  int r = 0;
+
+  acquire(&rq->lock);
+  for (int i = 0; i < rq->n && !r; i++)
+    if (rq->heap[i]->affinity & (1L << id))
+      r = 1;
+  release(&rq->lock);
+  return r;
+}
+
+// Take p off whichever run queue it is on.
+// Returns 1, or 0 if a scheduler has already taken it off.
+// Caller must hold p->lock.
+static int runqremove(struct proc *p)
+{
+  struct runq *rq;
+
+  for (rq = runq; rq < &runq[NCPU]; rq++)
+  {
+    acquire(&rq->lock);
+    for (int i = 0; i < rq->n; i++)
+    {
+      if (rq->heap[i] == p)
+      {
+        runqdel(rq, i);
+        release(&rq->lock);
+        return 1;
+      }
+    }
+    release(&rq->lock);
+  }
+  return 0;
+}
+#else
+// Append p to rq. Caller must hold rq->lock.
+static void runqput(struct runq *rq, struct proc *p)
+{
+  p->rqnext = 0;
+  if (rq->tail[p->prio])
+    rq->tail[p->prio]->rqnext = p;
+  else
+    rq->head[p->prio] = p;
+  rq->tail[p->prio] = p;
+  rq->n++;
+}
+
+// Unlink p, which follows prev (or is first if prev is 0),
+// from level prio of rq. Caller must hold rq->lock.
+static void runqunlink(struct runq *rq, int prio, struct proc *prev, struct proc *p)
+{
+  if (prev)
+    prev->rqnext = p->rqnext;
+  else
+    rq->head[prio] = p->rqnext;
+  if (rq->tail[prio] == p)
+    rq->tail[prio] = prev;
+  rq->n--;
+}
+
+#ifdef SCHED_MLFQ
+// If a boost period has begun since rq was last boosted, boost
+// every process waiting on it back to its starting level, so
+// that one waiting at a low level can't be starved by a stream
+// of arrivals at higher ones. Caller must hold rq->lock, which
+// guards the prio, slice and boost of the processes on rq.
+static void runqboost(struct runq *rq)
+{
+  uint period = __atomic_load_n(&ticks, __ATOMIC_RELAXED) / BOOSTTICKS;
+  struct proc *head[NPRIO], *p, *next;
+  int i, prio;
+
+  if (rq->boost == period)
+    return;
+  rq->boost = period;
+  for (i = 0; i < NPRIO; i++)
+  {
+    head[i] = rq->head[i];
+    rq->head[i] = rq->tail[i] = 0;
+  }
+  for (i = 0; i < NPRIO; i++)
+  {
+    for (p = head[i]; p; p = next)
+    {
+      next = p->rqnext;
+      p->boost = period;
+      p->prio = prio = baseprio(p);
+      p->slice = 0;
+      p->rqnext = 0;
+      if (rq->tail[prio])
+        rq->tail[prio]->rqnext = p;
+      else
+        rq->head[prio] = p;
+      rq->tail[prio] = p;
+    }
+  }
+}
+#endif
+
+// Take the first process of the highest level that may run on
+// CPU id off rq, or return 0 if there is none.
+static struct proc *runqget(struct runq *rq, int id)
+{
+  struct proc *p = 0, *prev;
+
+  acquire(&rq->lock);
+#ifdef SCHED_MLFQ
+  runqboost(rq);
+#endif
+  for (int i = 0; i < NPRIO && p == 0; i++)
+  {
+    for (prev = 0, p = rq->head[i]; p; prev = p, p = p->rqnext)
+    {
+      if (p->affinity & (1L << id))
+      {
+        runqunlink(rq, i, prev, p);
+        break;
+      }
+    }
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Whether rq holds a process that may run on CPU id.
+static int runqhas(struct runq *rq, int id)
+{
+  struct proc *p;
+  int r = 0;
+
+  acquire(&rq->lock);
+  for (int i = 0; i < NPRIO && !r; i++)
+    for (p = rq->head[i]; p && !r; p = p->rqnext)
+      if (p->affinity & (1L << id))
+        r = 1;
+  release(&rq->lock);
+  return r;
+}
+
+// Take p off whichever run queue it is on.
+// Returns 1, or 0 if a scheduler has already taken it off.
+// Caller must hold p->lock.
+static int runqremove(struct proc *p)
+{
+  struct runq *rq;
+  struct proc *q, *prev;
+
+  for (rq = runq; rq < &runq[NCPU]; rq++)
+  {
+    acquire(&rq->lock);
+    for (prev = 0, q = rq->head[p->prio]; q; prev = q, q = q->rqnext)
+    {
+      if (q == p)
+      {
+        runqunlink(rq, p->prio, prev, p);
+        release(&rq->lock);
+        return 1;
+      }
+    }
+    release(&rq->lock);
+  }
+  return 0;
+}
+#endif
+
+// Send an interprocessor interrupt to CPU id, to wake it up
+// if it is idle. timervec in kernelvec.S passes it on as a
+// supervisor software interrupt, like a timer interrupt.
+static void ipi(int id)
+{
+  *(uint32 *)CLINT_MSIP(id) = 1;
+}
+
+// Wake up an idle CPU to run p, which has just been added to
+// CPU id's run queue: CPU id itself, or, if it is busy and p
+// isn't the process giving it up, another idle CPU that may
+// run p, to steal it.
+static void kick(struct proc *p, int id)
+{
+  uint64 idle;
+
+  __sync_synchronize(); // order the enqueue before the load
+  idle = __atomic_load_n(&cpuidle, __ATOMIC_RELAXED);
+  if (idle & (1L << id))
+    ipi(id);
+  else if (p != myproc() && (idle &= p->affinity) != 0)
+    ipi(__builtin_ctzl(idle));
+}
+
+// Mark p RUNNABLE and add it to a run queue.
+// Caller must hold p->lock.
+static void setrunnable(struct proc *p)
+{
+  int id = pickcpu(p);
+  struct runq *rq = &runq[id];
+
+#ifdef SCHED_MLFQ
+  mlfqboost(p);
+#endif
+  p->state = RUNNABLE;
+  acquire(&rq->lock);
+  runqput(rq, p);
+  release(&rq->lock);
+  kick(p, id);
+}
+
+// Whether any run queue holds a process that CPU id may run,
+// on its own queue or to steal.
+static int runnable(int id)
+{
+  for (int i = 0; i < NCPU; i++)
+    if (__atomic_load_n(&runq[i].n, __ATOMIC_RELAXED) != 0 && runqhas(&runq[i], id))
+      return 1;
+  return 0;
+}
+
+// Wait in wfi for an interrupt, unless a process that CPU id
+// may run arrives on any run queue first. The CPU marks itself
+// idle before it looks at the queues, and kick() adds to a
+// queue before it looks for idle CPUs, so one or the other
+// sees the new process: kick() sends an IPI to this CPU if
+// the process went on its queue, or if it went on a busy
+// CPU's queue and this is an idle CPU that may steal it, and
+// otherwise this CPU finds it. wfi returns when an interrupt
+// is pending even with interrupts off, so an IPI that comes
+// after the look isn't taken too early to wake it.
+static void idle(int id)
+{
+  intr_off();
+  __sync_fetch_and_or(&cpuidle, 1L << id);
+  if (!runnable(id))
+    asm volatile("wfi");
+  __sync_fetch_and_and(&cpuidle, ~(1L << id));
+  intr_on();
+}
+
+// Steal a process for idle CPU id from the longest other queue
+// that holds one it may run.
+static struct proc *runqsteal(int id)
+{
+  uint64 tried = 1L << id;
+  struct proc *p;
+  int i, victim, n, maxn;
+
+  for (;;)
+  {
+    victim = -1;
+    maxn = 0;
+    for (i = 0; i < NCPU; i++)
+    {
+      n = __atomic_load_n(&runq[i].n, __ATOMIC_RELAXED);
+      if ((tried & (1L << i)) == 0 && n > maxn)
+      {
+        victim = i;
+        maxn = n;
+      }
+    }
+    if (victim < 0)
+      return 0;
+    if ((p = runqget(&runq[victim], id)) != 0)
+      return p;
+    tried |= 1L << victim;
+  }
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process off this CPU's run queue, or
+//    steal one from another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -461,31 +1138,45 @@ void scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
 
   c->proc = 0;
+  __sync_fetch_and_or(&cpuonline, 1L << id);
   for (;;)
   {
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for (p = proc; p < &proc[NPROC]; p++)
+    if ((p = runqget(&runq[id], id)) == 0 && (p = runqsteal(id)) == 0)
     {
-      acquire(&p->lock);
-      if (p->state == RUNNABLE)
-      {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+      // nothing to run; use the idle time to pre-zero pages,
+      // and when there are none to zero, sleep until an
+      // interrupt (such as an IPI from kick()).
+      if (kzero_refill() == 0)
+        idle(id);
+      continue;
     }
+
+    // p is off the queues but still RUNNABLE, so nothing
+    // else will change its state before we lock it. its
+    // last CPU may still be switching away from it, which
+    // holding p->lock waits for.
+    acquire(&p->lock);
+    if (p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    c->proc = p;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -520,11 +1211,87 @@ void yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
 
+// Called on each clock tick with the current process running.
+// Charges it for the tick, and returns 1 if it should yield
+// the CPU: always under round robin and stride scheduling
+// (which charges in advance, in runqget()); under MLFQ when
+// it has used up its level's quantum, and so drops a level,
+// or when a process at a higher level is waiting for this CPU.
+int schedtick(void)
+{
+#ifdef SCHED_MLFQ
+  struct proc *p = myproc();
+  struct runq *rq;
+  int r = 0;
+
+  acquire(&p->lock);
+  mlfqboost(p);
+  if (++p->slice >= quantum[p->prio])
+  {
+    if (p->prio < NPRIO - 1)
+      p->prio++;
+    p->slice = 0;
+    r = 1;
+  }
+  else
+  {
+    // a peek without the queue's lock; a wrong answer
+    // only costs or saves one switch.
+    rq = &runq[p->cpu];
+    for (int i = 0; i < p->prio; i++)
+      if (__atomic_load_n(&rq->head[i], __ATOMIC_RELAXED))
+        r = 1;
+  }
+  release(&p->lock);
+  return r;
+#else
+  return 1;
+#endif
+}
+
+// Add inc to the current process's nice value, keeping it
+// within 0..NICEMAX, and return the new value. Under MLFQ,
+// a nicer process starts at, and is boosted to, a lower
+// level; under round robin nice has no effect.
+int nice(int inc)
+{
+  struct proc *p = myproc();
+  int n;
+
+  acquire(&p->lock);
+  n = p->nice + inc;
+  if (n < 0)
+    n = 0;
+  if (n > NICEMAX)
+    n = NICEMAX;
+  p->nice = n;
+  p->prio = baseprio(p);
+  p->slice = 0;
+  release(&p->lock);
+  return n;
+}
+
+// Give the current process n tickets, its share of the CPU
+// under stride scheduling relative to the other processes on
+// its CPU. Returns 0, or -1 if n is out of range. Has no
+// effect on the other schedulers.
+int settickets(int n)
+{
+  struct proc *p = myproc();
+
+  if (n < 1 || n > MAXTICKETS)
+    return -1;
+  acquire(&p->lock);
+  p->tickets = n;
+  release(&p->lock);
+  return 0;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void forkret(void)
@@ -551,20 +1318,30 @@ void forkret(void)
 void sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = WAITQ(chan);
 
-  // Must acquire p->lock in order to
+  // Must acquire chan's wait queue lock in order to
+  // join the queue, and p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold the wait queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the wait queue),
   // so it's okay to release lk.
 
-  acquire(&p->lock); // DOC: sleeplock1
+  acquire(&wq->lock); // DOC: sleeplock1
+  acquire(&p->lock);
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->wqnext = 0;
+  if (wq->tail)
+    wq->tail->wqnext = p;
+  else
+    wq->head = p;
+  wq->tail = p;
+  release(&wq->lock);
 
   sched();
 
@@ -576,24 +1353,83 @@ void sleep(void *chan, struct spinlock *lk)
   acquire(lk);
 }
 
+// Take p, which follows prev (or is first if prev is 0), off
+// wq and make it RUNNABLE. Caller must hold wq->lock.
+static void waitqwake(struct waitq *wq, struct proc *prev, struct proc *p)
+{
+  if (prev)
+    prev->wqnext = p->wqnext;
+  else
+    wq->head = p->wqnext;
+  if (wq->tail == p)
+    wq->tail = prev;
+  acquire(&p->lock);
+  setrunnable(p);
+  release(&p->lock);
+}
+
+// Wake up processes sleeping on chan: all of them,
+// or only the one that has slept longest if one is set.
+// Must be called without any p->lock.
+static void wake(void *chan, int one)
+{
+  struct waitq *wq = WAITQ(chan);
+  struct proc *p, *prev = 0, *next;
+
+  acquire(&wq->lock);
+  for (p = wq->head; p; p = next)
+  {
+    next = p->wqnext;
+    if (p->chan != chan)
+    {
+      prev = p;
+      continue;
+    }
+    waitqwake(wq, prev, p);
+    if (one)
+      break;
+  }
+  release(&wq->lock);
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void wakeup(void *chan)
+{
+  wake(chan, 0);
+}
+
+// Wake up the process that has slept longest on chan, for
+// when whatever it waits for can satisfy only one sleeper;
+// each sleeper that gets it should wake the next if there
+// is more to be had. Must be called without any p->lock.
+void wakeone(void *chan)
+{
+  wake(chan, 1);
+}
+
+// Return the process with the given pid, locked,
+// or 0 if there is none.
+static struct proc *findproc(int pid)
 {
   struct proc *p;
 
-  for (p = proc; p < &proc[NPROC]; p++)
+  if (pid <= 0)
+    return 0;
+  acquire(&pidhash.lock);
+  for (p = pidhash.head[pid % NPIDHASH]; p && p->pid != pid; p = p->pidnext)
+    ;
+  release(&pidhash.lock);
+  if (p == 0)
+    return 0;
+  acquire(&p->lock);
+  if (p->pid != pid)
   {
-    if (p != myproc())
-    {
-      acquire(&p->lock);
-      if (p->state == SLEEPING && p->chan == chan)
-      {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-    }
+    // freed since; pids aren't reused, so it is gone.
+    release(&p->lock);
+    return 0;
   }
+  return p;
 }
 
 // Kill the process with the given pid.
@@ -601,25 +1437,53 @@ void wakeup(void *chan)
 // to user space (see usertrap() in trap.c).
 int kill(int pid)
 {
-  struct proc *p;
+  struct proc *p, *q, *prev;
+  struct waitq *wq;
+  void *chan;
 
-  for (p = proc; p < &proc[NPROC]; p++)
+  if ((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  chan = p->state == SLEEPING ? p->chan : 0;
+  release(&p->lock);
+  if (chan)
   {
-    acquire(&p->lock);
-    if (p->pid == pid)
+    // Wake process from sleep(), if it is still on
+    // chan's wait queue, which must be locked first.
+    wq = WAITQ(chan);
+    acquire(&wq->lock);
+    for (prev = 0, q = wq->head; q; prev = q, q = q->wqnext)
     {
-      p->killed = 1;
-      if (p->state == SLEEPING)
+      if (q == p)
       {
-        // Wake process from sleep().
-        p->state = RUNNABLE;
+        waitqwake(wq, prev, p);
+        break;
       }
-      release(&p->lock);
-      return 0;
     }
-    release(&p->lock);
+    release(&wq->lock);
   }
-  return -1;
+  return 0;
+}
+
+// Let the process with the given pid run only on the CPUs
+// in mask. Returns -1 if there is no such process, or if
+// none of the CPUs in mask is running.
+int setaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+
+  if ((mask & __atomic_load_n(&cpuonline, __ATOMIC_RELAXED)) == 0)
+    return -1;
+  if ((p = findproc(pid)) == 0)
+    return -1;
+  p->affinity = mask;
+  // move it to a queue it may be taken from.
+  if (p->state == RUNNABLE && runqremove(p))
+    setrunnable(p);
+  release(&p->lock);
+  if (p == myproc() && (mask & (1L << p->cpu)) == 0)
+    yield(); // to a CPU in mask
+  return 0;
 }
 
 void setkilled(struct proc *p)
@@ -702,18 +1566,10 @@ void procdump(void)
   }
 }
 
+// Return the number of processes that are not UNUSED.
+// Takes no locks; see nliveproc.
 int
 getnproc(void)
 {
-  int n = 0;
-  struct proc *p;
-
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->state != UNUSED)
-      n++;
-    release(&p->lock);
-  }
-  return n;
+  return __atomic_load_n(&nliveproc, __ATOMIC_RELAXED);
 }
-
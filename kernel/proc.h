@@ -26,6 +26,7 @@ struct cpu
   struct context context; // swtch() here to enter scheduler().
   int noff;               // Depth of push_off() nesting.
   int intena;             // Were interrupts enabled before push_off()?
+  uint64 asidgen;         // ASID generation the TLB was last flushed for.
 };
 
 extern struct cpu cpus[NCPU];
@@ -92,6 +93,21 @@ enum procstate
   ZOMBIE
 };
 
+// A memory mapping made by mmap() or exec(); see mmap.c.
+// The slot is unused if end is 0.
+struct vma
+{
+  uint64 start;      // first address, page-aligned
+  uint64 end;        // one past the last address, page-aligned
+  int prot;          // PROT_*
+  int flags;         // MAP_*, VMA_IMAGE
+  struct inode *ip;  // mapped file, or 0 if anonymous
+  struct anon *anon; // pages of MAP_SHARED anonymous memory, or 0
+  uint64 off;        // file offset that start maps
+};
+
+#define VMA_IMAGE 0x1000 // program segment mapped by exec(), below p->sz
+
 // Per-process state
 struct proc
 {
@@ -103,19 +119,46 @@ struct proc
   int killed;           // If non-zero, have been killed
   int xstate;           // Exit status to be returned to parent's wait
   int pid;              // Process ID
+  int cpu;              // CPU it last ran on, or -1 if it hasn't run
+  uint64 affinity;      // Mask of CPUs it may run on
+  int nice;             // 0..NICEMAX; higher runs at lower priority
+  int prio;             // Run queue level; 0 is the highest
+  int slice;            // Ticks run at this level (MLFQ)
+  uint boost;           // Boost period it was last boosted in (MLFQ)
+  int tickets;          // Share of the CPU (stride)
+  uint64 pass;          // Virtual time it has been given (stride)
+
+  // the lock of the run queue it is on must be held when using this:
+  struct proc *rqnext;  // Next process on the run queue
+
+  // the lock of the wait queue it is on must be held when using this:
+  struct proc *wqnext;  // Next process sleeping in the same bucket
+
+  // pidhash.lock must be held when using this:
+  struct proc *pidnext; // Next process in the same pid hash bucket
 
-  // wait_lock must be held when using this:
-  struct proc *parent; // Parent process
+  // wait_lock must be held when using these:
+  struct proc *parent;   // Parent process
+  struct proc *children; // First child
+  struct proc *sibling;  // Next child of the same parent
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
+  uint64 nreserved;            // Pages below sz reserved but not yet allocated
   pagetable_t pagetable;       // User page table
+  int asid;                    // Address-space ID for satp; see uvmsatp()
+  uint64 asidgen;              // ASID generation that asid belongs to
+  int tlbcpu;                  // Hart that last entered user space for us
+  int tlbflush;                // Page table changed; flush asid on return
+  int kyield;                  // Preempted in kernel mode; see swap.c
+  void (*kthread)(void);       // Body of a kernel thread, or 0
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  struct vma vma[NVMA];        // Memory mappings
 
   // (HW1-1) the parameter for the trace system call
   int trace_mask;
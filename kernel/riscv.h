@@ -201,6 +201,14 @@ w_pmpaddr0(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// satp bits 44-59 hold the address-space ID, which tags the
+// TLB entries made under that satp. a hart may implement fewer
+// bits; the rest read as zero.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK 0xffffL
+#define MAKE_SATP_ASID(pagetable, asid) \
+  (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -327,6 +335,13 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries for one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -343,6 +358,10 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_A (1L << 6) // accessed; set by hardware
+#define PTE_D (1L << 7) // dirty; set by hardware
+#define PTE_COW (1L << 8) // copy-on-write; RSW bit, ignored by hardware
+#define PTE_SWAP (1L << 9) // swapped out (with PTE_V clear); RSW bit
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -351,11 +370,21 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a valid PTE with any of R, W, X set is a leaf; otherwise it
+// points to the next level's page-table page.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
 #define PX(level, va) ((((uint64) (va)) >> PXSHIFT(level)) & PXMASK)
 
+// bytes mapped by a leaf PTE at each level: a level-1 leaf
+// maps a 2-megabyte superpage.
+#define PXSIZE(level)   (1L << PXSHIFT(level))
+#define SUPERPGSIZE     PXSIZE(1)
+#define SUPERPGORDER    9 // SUPERPGSIZE is 2^9 pages
+
 // one beyond the highest possible virtual address.
 // MAXVA is actually one bit less than the max allowed by
 // Sv39, to avoid having to sign-extend virtual addresses
@@ -0,0 +1,323 @@
+// Slab allocator for small kernel objects.
+//
+// A cache hands out objects of a single size. Objects are
+// carved out of whole pages ("slabs") obtained from kalloc();
+// each slab starts with a struct slab header, followed by as
+// many objects as fit. Each object is followed by a link word
+// that threads it onto its slab's free list, so a free object
+// keeps whatever state its constructor gave it.
+//
+// In front of the slabs, every cache has a small per-CPU
+// magazine of free objects, so that most allocations and
+// frees touch only the current CPU's magazine. A magazine is
+// refilled from, and flushed back to, the slabs half a
+// magazine at a time.
+//
+// A slab whose objects have all been freed goes straight back
+// to kalloc(), unless the cache keeps it in reserve (see
+// kmem_cache_reserve()). Objects sitting in magazines keep
+// their slabs alive; kmem_cache_reap() flushes all magazines,
+// and kalloc() calls it before giving up.
+//
+// Lock order: a magazine's lock and its cache's lock are never
+// held together, and neither is held across a call to kalloc()
+// or kfree().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCACHE   16   // max number of caches
+#define MAGSIZE  16   // objects per per-CPU magazine
+
+struct kmem_cache;
+
+struct slab {
+  struct slab *next;        // on cache's partial list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  char *free;               // first free object
+  int inuse;                // objects not on free
+};
+
+struct magazine {
+  struct spinlock lock;
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kmem_cache {
+  struct spinlock lock;     // protects partial and the slabs on it
+  char *name;
+  uint size;                // object size, rounded up to 8 bytes
+  int perslab;              // objects per slab
+  void (*ctor)(void*);      // initializes each new object, or 0
+  struct slab *partial;     // slabs with at least one free object
+  int nslab;                // slabs held by this cache
+  int minslab;              // slabs kept even when empty
+  struct magazine mag[NCPU];
+};
+
+struct {
+  struct kmem_cache cache[NCACHE];
+  int n;
+} kcaches;
+
+// Where an object keeps its free-list link.
+#define OBJLINK(c, o) (*(char**)((o) + (c)->size))
+
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+// Create a cache of objects of the given size. ctor, if
+// not 0, is called once on each object when its slab is
+// created; objects must be freed in that same state.
+// Only used when booting.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmem_cache *c;
+
+  size = (size + 7) & ~7;
+  if(SLABHDR + size + sizeof(char*) > PGSIZE)
+    panic("kmem_cache_create: size");
+
+  if(kcaches.n >= NCACHE)
+    panic("kmem_cache_create: too many");
+  c = &kcaches.cache[kcaches.n++];
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / (size + sizeof(char*));
+  c->ctor = ctor;
+  c->partial = 0;
+  c->nslab = 0;
+  c->minslab = 0;
+  for(int i = 0; i < NCPU; i++){
+    initlock(&c->mag[i].lock, "magazine");
+    c->mag[i].n = 0;
+  }
+  return c;
+}
+
+static void
+partial_remove(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+partial_push(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+// Add a new slab to c. Returns 0, or -1 if out of memory.
+static int
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return -1;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  o = (char*)s + SLABHDR + (c->perslab - 1) * (c->size + sizeof(char*));
+  for(i = 0; i < c->perslab; i++){
+    if(c->ctor)
+      c->ctor(o);
+    OBJLINK(c, o) = s->free;
+    s->free = o;
+    o -= c->size + sizeof(char*);
+  }
+
+  acquire(&c->lock);
+  partial_push(c, s);
+  c->nslab++;
+  release(&c->lock);
+  return 0;
+}
+
+// Keep enough slabs in c for n objects from now on, even
+// when they are empty, so that while fewer than n objects are
+// allocated, kmem_cache_alloc() can't run out of memory.
+// Only used when booting.
+void
+kmem_cache_reserve(struct kmem_cache *c, int n)
+{
+  c->minslab = (n + c->perslab - 1) / c->perslab;
+  while(c->nslab < c->minslab){
+    if(slab_grow(c) < 0)
+      panic("kmem_cache_reserve");
+  }
+}
+
+// Take up to n objects from c's slabs into obj[].
+// Returns the number taken.
+static int
+slab_get(struct kmem_cache *c, void **obj, int n)
+{
+  struct slab *s;
+  int i;
+
+  acquire(&c->lock);
+  for(i = 0; i < n && (s = c->partial) != 0; i++){
+    obj[i] = s->free;
+    s->free = OBJLINK(c, s->free);
+    s->inuse++;
+    if(s->free == 0)
+      partial_remove(c, s);
+  }
+  release(&c->lock);
+  return i;
+}
+
+// Return n objects to their slabs, and give any slab
+// that becomes empty back to kalloc().
+static void
+slab_put(struct kmem_cache *c, void **obj, int n)
+{
+  struct slab *s, *empty = 0;
+  char *o;
+  int i;
+
+  acquire(&c->lock);
+  for(i = 0; i < n; i++){
+    o = obj[i];
+    s = (struct slab*)PGROUNDDOWN((uint64)o);
+    if(s->cache != c)
+      panic("kmem_cache_free: wrong cache");
+    if(s->free == 0)
+      partial_push(c, s);
+    OBJLINK(c, o) = s->free;
+    s->free = o;
+    if(--s->inuse == 0 && c->nslab > c->minslab){
+      partial_remove(c, s);
+      c->nslab--;
+      s->next = empty;
+      empty = s;
+    }
+  }
+  release(&c->lock);
+
+  while(empty){
+    s = empty;
+    empty = s->next;
+    kfree(s);
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if out of memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *obj[MAGSIZE/2 + 1];
+  void *o = 0;
+  int n;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n > 0)
+    o = m->obj[--m->n];
+  release(&m->lock);
+
+  if(o == 0){
+    // refill half a magazine, plus one for the caller.
+    while((n = slab_get(c, obj, MAGSIZE/2 + 1)) == 0){
+      if(slab_grow(c) < 0){
+        // kalloc() flushed every magazine before it gave up,
+        // which may have put free objects back on the slabs.
+        if((n = slab_get(c, obj, MAGSIZE/2 + 1)) > 0)
+          break;
+        pop_off();
+        return 0;
+      }
+    }
+    o = obj[--n];
+    acquire(&m->lock);
+    while(n > 0 && m->n < MAGSIZE)
+      m->obj[m->n++] = obj[--n];
+    release(&m->lock);
+    if(n > 0)
+      slab_put(c, obj, n);
+  }
+  pop_off();
+  return o;
+}
+
+// Free an object allocated from cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *o)
+{
+  struct magazine *m;
+  void *obj[MAGSIZE/2];
+  int n = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == MAGSIZE){
+    // full; send the older half back to the slabs.
+    n = MAGSIZE/2;
+    memmove(obj, m->obj, n * sizeof(void*));
+    memmove(m->obj, m->obj + n, (MAGSIZE - n) * sizeof(void*));
+    m->n -= n;
+  }
+  m->obj[m->n++] = o;
+  release(&m->lock);
+  if(n > 0)
+    slab_put(c, obj, n);
+  pop_off();
+}
+
+// Flush every CPU's magazine in every cache back to the
+// slabs, freeing slabs that become empty.
+// Returns the number of slabs released.
+int
+kmem_cache_reap(void)
+{
+  struct kmem_cache *c;
+  struct magazine *m;
+  void *obj[MAGSIZE];
+  int i, j, n, nslab, freed = 0;
+
+  for(i = 0; i < kcaches.n; i++){
+    c = &kcaches.cache[i];
+    acquire(&c->lock);
+    nslab = c->nslab;
+    release(&c->lock);
+    for(j = 0; j < NCPU; j++){
+      m = &c->mag[j];
+      acquire(&m->lock);
+      memmove(obj, m->obj, m->n * sizeof(void*));
+      n = m->n;
+      m->n = 0;
+      release(&m->lock);
+      if(n > 0)
+        slab_put(c, obj, n);
+    }
+    acquire(&c->lock);
+    if(c->nslab < nslab)
+      freed += nslab - c->nslab;
+    release(&c->lock);
+  }
+  return freed;
+}
@@ -0,0 +1,16 @@
+// File actions for spawn(), applied in order to a copy of
+// the parent's open files before the child starts.
+// The list ends with a SPAWN_END entry.
+#define SPAWN_END    0
+#define SPAWN_CLOSE  1  // close fd
+#define SPAWN_DUP    2  // make fd a duplicate of fd arg
+#define SPAWN_OPEN   3  // open path with mode arg as fd
+
+#define NSPAWNACT    8  // max file actions per spawn()
+
+struct spawnact {
+  int op;
+  int fd;
+  int arg;
+  char *path;
+};
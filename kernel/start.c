@@ -11,15 +11,19 @@ void timerinit();
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
 // a scratch area per CPU for machine-mode timer interrupts.
-uint64 timer_scratch[NCPU][5];
+uint64 timer_scratch[NCPU][7];
 
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
 
-// entry.S jumps here in machine mode on stack0.
+// entry.S jumps here in machine mode on stack0,
+// with the address of the device tree in fdt.
 void
-start()
+start(uint64 hartid, uint64 fdt)
 {
+  if(r_mhartid() == 0)
+    fdtaddr = fdt;
+
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
   x &= ~MSTATUS_MPP_MASK;
@@ -58,7 +62,7 @@ start()
 // they will arrive in machine mode at
 // at timervec in kernelvec.S,
 // which turns them into software interrupts for
-// devintr() in trap.c.
+// devintr() in trap.c. so does an IPI (see ipi()).
 void
 timerinit()
 {
@@ -73,9 +77,13 @@ timerinit()
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
   // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[5] : set by each timer interrupt, cleared by devintr().
+  // scratch[6] : address of CLINT MSIP register, for IPIs.
   uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
   scratch[4] = interval;
+  scratch[5] = 0;
+  scratch[6] = CLINT_MSIP(id);
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -84,6 +92,8 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer and software interrupts;
+  // the latter are IPIs from other CPUs, which timervec
+  // also passes on to supervisor mode.
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
 }
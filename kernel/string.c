@@ -41,11 +41,27 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    // a word at a time if both ends are word-aligned alike.
+    if((((uint64)s | (uint64)d) & 7) == 0){
+      for(; n >= 8; n -= 8){
+        d -= 8;
+        s -= 8;
+        *(uint64*)d = *(const uint64*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if((((uint64)s | (uint64)d) & 7) == 0){
+      for(; n >= 8; n -= 8){
+        *(uint64*)d = *(const uint64*)s;
+        d += 8;
+        s += 8;
+      }
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
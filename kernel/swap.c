@@ -0,0 +1,312 @@
+//
+// Swapping of user pages to the swap area, which follows the
+// file system on the disk (see SWAPSTART in fs.h).
+//
+// When memory runs out while a user page fault is being
+// handled, swapreclaim() evicts cold pages to make room.
+// A clock hand sweeps over the processes' user pages. It
+// clears each page's accessed bit (PTE_A, set by the
+// hardware), and evicts a page whose bit is still clear when
+// the hand comes round again. An evicted page's PTE is left
+// invalid, with PTE_SWAP set and the swap slot in place of
+// the physical page number; uvmfault() calls swapin() to
+// read the page back.
+//
+// Only private anonymous pages are evicted: 4096-byte pages
+// with one reference, outside any mmap() mapping. fork()
+// shares a slot as it would share a copy-on-write page, and
+// each slot counts the PTEs that refer to it.
+//
+// The hand skips the pages of a process that is running, or
+// that was preempted in kernel mode, since its kernel code
+// may be using one of its pages' physical addresses. The
+// process that is reclaiming can evict its own pages, since
+// it holds no such address while it does so.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "defs.h"
+
+// pages evicted by one call to swapreclaim(), and pages
+// looked at per hold of a process's lock.
+#define SWAPBATCH 16
+#define SWAPSCAN  1024
+
+#define PTE2SLOT(pte) ((pte) >> 10)
+#define SLOT2PTE(s)   ((uint64)(s) << 10)
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct spinlock lock;
+  uchar ref[NSWAP];   // PTEs referring to each slot
+  uchar busy[NSWAP];  // is the slot being read or written?
+  int nfree;          // slots with no references that aren't busy
+  int next;           // where to start looking for a free slot
+  uint64 nswapin;
+  uint64 nswapout;
+} swap;
+
+// swapio serializes use of swapbuf for disk transfers.
+struct sleeplock swapio;
+struct buf swapbuf;
+
+// the clock hand: the next page to look at is va of proc[hand].
+// protected by clock.lock, which a reclaimer holds throughout.
+struct {
+  struct sleeplock lock;
+  int hand;
+  uint64 va;
+} clock;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swapio, "swapio");
+  initsleeplock(&clock.lock, "swapclock");
+  swap.nfree = NSWAP;
+}
+
+// can the caller sleep? not while it holds a spinlock.
+static int
+cansleep(void)
+{
+  int r;
+
+  push_off();
+  r = mycpu()->noff == 1;
+  pop_off();
+  return r;
+}
+
+// Read or write the page at pa from or to swap slot slot.
+static void
+swaprw(int slot, char *pa, int write)
+{
+  acquiresleep(&swapio);
+  for(int i = 0; i < PGSIZE / BSIZE; i++){
+    swapbuf.blockno = SWAPSTART + slot * (PGSIZE / BSIZE) + i;
+    if(write)
+      memmove(swapbuf.data, pa + i * BSIZE, BSIZE);
+    virtio_disk_rw(&swapbuf, write);
+    if(!write)
+      memmove(pa + i * BSIZE, swapbuf.data, BSIZE);
+  }
+  releasesleep(&swapio);
+}
+
+// Finish I/O on slot: wake up anyone waiting for it, and
+// free it if no PTE refers to it any more.
+// Caller must hold swap.lock.
+static void
+swapdone(int slot)
+{
+  swap.busy[slot] = 0;
+  if(swap.ref[slot] == 0)
+    swap.nfree++;
+  wakeup(&swap.busy[slot]);
+}
+
+// Return the number of free swap slots. Takes no lock.
+uint64
+swapfreepages(void)
+{
+  return __atomic_load_n(&swap.nfree, __ATOMIC_RELAXED);
+}
+
+// Add a reference to the swap slot in the swapped-out PTE pte.
+void
+swapdup(pte_t pte)
+{
+  acquire(&swap.lock);
+  swap.ref[PTE2SLOT(pte)]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to the swap slot in the swapped-out PTE pte.
+void
+swapfree(pte_t pte)
+{
+  int slot = PTE2SLOT(pte);
+
+  acquire(&swap.lock);
+  if(swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0 && !swap.busy[slot])
+    swap.nfree++;
+  release(&swap.lock);
+}
+
+// Read the swapped-out page that *pte maps at va back in.
+// pte must belong to the current process's page table.
+// Returns 0, or -1 if out of memory or the caller holds
+// a spinlock.
+int
+swapin(pagetable_t pagetable, uint64 va, pte_t *pte)
+{
+  int slot = PTE2SLOT(*pte);
+  char *mem;
+
+  if(!cansleep())
+    return -1;
+
+  // the slot may still be being written out.
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.lock);
+  swap.busy[slot] = 1;
+  release(&swap.lock);
+
+  if((mem = kalloc()) == 0){
+    swapreclaim();
+    mem = kalloc();
+  }
+  if(mem)
+    swaprw(slot, mem, 0);
+
+  acquire(&swap.lock);
+  if(mem){
+    swap.ref[slot]--;
+    swap.nswapin++;
+  }
+  swapdone(slot);
+  release(&swap.lock);
+  if(mem == 0)
+    return -1;
+
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+  uvmflush(pagetable);
+  return 0;
+}
+
+// Take a free swap slot and mark it busy, or return -1.
+static int
+slotalloc(void)
+{
+  int slot = -1;
+
+  acquire(&swap.lock);
+  for(int i = 0; swap.nfree > 0 && i < NSWAP; i++){
+    int s = (swap.next + i) % NSWAP;
+    if(swap.ref[s] == 0 && !swap.busy[s]){
+      slot = s;
+      swap.ref[s] = 1;
+      swap.busy[s] = 1;
+      swap.nfree--;
+      swap.next = s + 1;
+      break;
+    }
+  }
+  release(&swap.lock);
+  return slot;
+}
+
+// Advance the clock hand over up to SWAPSCAN pages of p,
+// which the caller has locked, evicting up to SWAPBATCH
+// cold ones (superpages are left alone). Records
+// the evicted pages' slots and physical addresses in slot[]
+// and pa[], to be written out once p is unlocked, and returns
+// their number. Sets *done when the hand reaches the end of p.
+static int
+sweep(struct proc *p, int *slot, char **pa, int *done)
+{
+  pte_t *pte;
+  int n = 0, s, level, scanned;
+
+  *done = 0;
+  for(scanned = 0; n < SWAPBATCH && scanned < SWAPSCAN; clock.va += PGSIZE){
+    if(clock.va >= p->sz){
+      *done = 1;
+      break;
+    }
+    scanned++;
+    level = 0;
+    pte = walklevel(p->pagetable, clock.va, 0, &level);
+    if(pte == 0 || level != 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      continue;
+    if(*pte & PTE_A){
+      // give the page another round to be used.
+      *pte &= ~PTE_A;
+      p->tlbflush = 1;
+      continue;
+    }
+    if(krefcount((void*)PTE2PA(*pte)) != 1 || vmafind(p, clock.va))
+      continue;
+    if((s = slotalloc()) < 0){
+      *done = 1;
+      break;
+    }
+    slot[n] = s;
+    pa[n] = (char*)PTE2PA(*pte);
+    n++;
+    *pte = SLOT2PTE(s) | (PTE_FLAGS(*pte) & ~PTE_V) | PTE_SWAP;
+    p->tlbflush = 1;
+  }
+  return n;
+}
+
+// Evict up to SWAPBATCH cold user pages to the swap area.
+// The caller must not hold any locks, and must not be using
+// the physical address of any of its own user pages.
+// Returns the number of pages evicted.
+int
+swapreclaim(void)
+{
+  int slot[SWAPBATCH];
+  char *pa[SWAPBATCH];
+  struct proc *p;
+  int n = 0, k, done, visits;
+
+  if(!cansleep())
+    return 0;
+
+  acquiresleep(&clock.lock);
+  // two passes, so a page whose accessed bit the first
+  // pass clears can be evicted by the second.
+  for(visits = 0; n == 0 && visits <= 2*NPROC; ){
+    p = &proc[clock.hand];
+    acquire(&p->lock);
+    k = 0;
+    done = 1;
+    if(p->state != UNUSED && p->state != USED && p->state != ZOMBIE &&
+       (p == myproc() || (p->state != RUNNING && !p->kyield)))
+      k = sweep(p, slot, pa, &done);
+    release(&p->lock);
+
+    for(int i = 0; i < k; i++){
+      swaprw(slot[i], pa[i], 1);
+      kfree(pa[i]);
+      acquire(&swap.lock);
+      swap.nswapout++;
+      swapdone(slot[i]);
+      release(&swap.lock);
+    }
+    n += k;
+
+    if(done){
+      clock.hand = (clock.hand + 1) % NPROC;
+      clock.va = 0;
+      visits++;
+    }
+  }
+  releasesleep(&clock.lock);
+  return n;
+}
+
+// Report the numbers of pages read from and written to swap.
+// Takes no lock.
+void
+getswapstats(uint64 *nin, uint64 *nout)
+{
+  *nin = __atomic_load_n(&swap.nswapin, __ATOMIC_RELAXED);
+  *nout = __atomic_load_n(&swap.nswapout, __ATOMIC_RELAXED);
+}
@@ -99,6 +99,12 @@ extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_trace(void);   // (HW1-1) add trace syscall prototype
 extern uint64 sys_sysinfo(void); // (HW1-2) add sysinfo syscall prototype
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_nice(void);
+extern uint64 sys_settickets(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +132,12 @@ static uint64 (*syscalls[])(void) = {
     [SYS_close] sys_close,
     [SYS_trace] sys_trace,
     [SYS_sysinfo] sys_sysinfo,
+    [SYS_mmap] sys_mmap,
+    [SYS_munmap] sys_munmap,
+    [SYS_spawn] sys_spawn,
+    [SYS_setaffinity] sys_setaffinity,
+    [SYS_nice] sys_nice,
+    [SYS_settickets] sys_settickets,
 };
 
 // (HW1-1) An array mapping syscall name
@@ -153,6 +165,12 @@ static char *syscall_names[] = {
     [SYS_close] "close",
     [SYS_trace] "trace",
     [SYS_sysinfo] "sysinfo",
+    [SYS_mmap] "mmap",
+    [SYS_munmap] "munmap",
+    [SYS_spawn] "spawn",
+    [SYS_setaffinity] "setaffinity",
+    [SYS_nice] "nice",
+    [SYS_settickets] "settickets",
 };
 
 void syscall(void)
@@ -21,4 +21,10 @@
 #define SYS_mkdir 20
 #define SYS_close 21
 #define SYS_trace 22   // (HW1-1) add trace syscall number
-#define SYS_sysinfo 23 // (HW1-2) add sysinfo syscall number
\ No newline at end of file
+#define SYS_sysinfo 23 // (HW1-2) add sysinfo syscall number
+#define SYS_mmap 24
+#define SYS_munmap 25
+#define SYS_spawn 26
+#define SYS_setaffinity 27
+#define SYS_nice 28
+#define SYS_settickets 29
@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "spawn.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -301,18 +302,13 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path with mode omode, for open() and spawn().
+// Returns a new file, or 0 on error.
+static struct file*
+openfile(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -320,33 +316,31 @@ sys_open(void)
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
       end_op();
-      return -1;
+      return 0;
     }
   } else {
     if((ip = namei(path)) == 0){
       end_op();
-      return -1;
+      return 0;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       end_op();
-      return -1;
+      return 0;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
 
   if(ip->type == T_DEVICE){
@@ -367,6 +361,25 @@ sys_open(void)
   iunlock(ip);
   end_op();
 
+  return f;
+}
+
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int fd, omode;
+  struct file *f;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if((f = openfile(path, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -431,20 +444,28 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Free the argument strings fetched by fetchargv().
+static void
+freeargv(char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Copy the user's null-terminated argument vector at uargv
+// into argv[MAXARG], one kalloc()ed page per string.
+// Returns 0, or -1 (having freed everything) on error.
+static int
+fetchargv(uint64 uargv, char **argv)
+{
+  int i;
+  uint64 uarg;
+
+  memset(argv, 0, MAXARG * sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -460,17 +481,107 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
 
-  int ret = exec(path, argv);
+ bad:
+  freeargv(argv);
+  return -1;
+}
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = exec(path, argv);
 
+  freeargv(argv);
   return ret;
+}
+
+// Apply spawn file action a to the file table ofile.
+// Returns 0, or -1 on error.
+static int
+applyact(struct file **ofile, struct spawnact *a)
+{
+  char path[MAXPATH];
+  struct file *f;
+
+  if(a->fd < 0 || a->fd >= NOFILE)
+    return -1;
+  switch(a->op){
+  case SPAWN_CLOSE:
+    f = 0;
+    break;
+  case SPAWN_DUP:
+    if(a->arg < 0 || a->arg >= NOFILE || ofile[a->arg] == 0)
+      return -1;
+    f = filedup(ofile[a->arg]);
+    break;
+  case SPAWN_OPEN:
+    if(fetchstr((uint64)a->path, path, MAXPATH) < 0)
+      return -1;
+    if((f = openfile(path, a->arg)) == 0)
+      return -1;
+    break;
+  default:
+    return -1;
+  }
+  if(ofile[a->fd])
+    fileclose(ofile[a->fd]);
+  ofile[a->fd] = f;
+  return 0;
+}
+
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  struct file *ofile[NOFILE];
+  struct spawnact act;
+  struct proc *p = myproc();
+  uint64 uargv, uact;
+  int i, pid;
+
+  argaddr(1, &uargv);
+  argaddr(2, &uact);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  // the child starts with the parent's open files,
+  // as after fork(), then applies the file actions.
+  for(i = 0; i < NOFILE; i++)
+    ofile[i] = p->ofile[i] ? filedup(p->ofile[i]) : 0;
+  for(i = 0; uact != 0; i++){
+    if(copyin(p->pagetable, (char*)&act, uact + i*sizeof(act), sizeof(act)) < 0)
+      goto bad;
+    if(act.op == SPAWN_END)
+      break;
+    if(i >= NSPAWNACT || applyact(ofile, &act) < 0)
+      goto bad;
+  }
+
+  if((pid = spawn(path, argv, ofile)) < 0)
+    goto bad;
+  freeargv(argv);
+  return pid;
 
  bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+  for(i = 0; i < NOFILE; i++){
+    if(ofile[i])
+      fileclose(ofile[i]);
+  }
+  freeargv(argv);
   return -1;
 }
 
@@ -503,3 +614,30 @@ sys_pipe(void)
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len, off;
+  int prot, flags;
+  struct file *f = 0;
+
+  argaddr(0, &addr); // a hint, which is ignored
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argaddr(5, &off);
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(f, len, prot, flags, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
@@ -1,4 +1,12 @@
 struct sysinfo {
   uint64 freemem;   // amount of free memory (bytes)
   uint64 nproc;     // number of process
+  uint64 totalmem;  // amount of RAM (bytes)
+  uint64 freeblocks[MAXORDER+1]; // free buddy blocks of each order
+  uint64 superpromoted; // superpages that have backed user memory
+  uint64 superdemoted;  // superpages split back into pages
+  uint64 swapin;        // pages read back in from swap
+  uint64 swapout;       // pages written out to swap
+  uint64 ksmmerged;     // pages merged with an identical page
+  uint64 ksmsaved;      // bytes that merged pages now save
 };
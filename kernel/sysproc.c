@@ -67,7 +67,7 @@ sys_sleep(void)
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    tickwait(ticks0 + n);
   }
   release(&tickslock);
   return 0;
@@ -82,6 +82,38 @@ sys_kill(void)
   return kill(pid);
 }
 
+// restrict a process to a set of CPUs, given as a bit mask.
+uint64
+sys_setaffinity(void)
+{
+  int pid;
+  uint64 mask;
+
+  argint(0, &pid);
+  argaddr(1, &mask);
+  return setaffinity(pid, mask);
+}
+
+// lower (or raise) the calling process's priority.
+uint64
+sys_nice(void)
+{
+  int inc;
+
+  argint(0, &inc);
+  return nice(inc);
+}
+
+// set the calling process's share of the CPU.
+uint64
+sys_settickets(void)
+{
+  int n;
+
+  argint(0, &n);
+  return settickets(n);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
@@ -116,7 +148,12 @@ sys_sysinfo(void)
   argaddr(0, &uaddr);
 
   si.freemem = getfreemem();
+  si.totalmem = PHYSTOP - KERNBASE;
   si.nproc = getnproc();
+  getfreeblocks(si.freeblocks);
+  getsuperstats(&si.superpromoted, &si.superdemoted);
+  getswapstats(&si.swapin, &si.swapout);
+  getksmstats(&si.ksmmerged, &si.ksmsaved);
 
   // 只有 copyout 會回報錯誤
   if (copyout(myproc()->pagetable, uaddr, (char *)&si, sizeof(si)) < 0)
@@ -9,6 +9,11 @@
 struct spinlock tickslock;
 uint ticks;
 
+// the earliest tick that a tickwait() caller waits for, if
+// tickarmed. protected by tickslock.
+static uint tickdue;
+static int tickarmed;
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -16,6 +21,9 @@ void kernelvec();
 
 extern int devintr();
 
+// in start.c; timervec sets [id][5] on each timer interrupt.
+extern uint64 timer_scratch[NCPU][7];
+
 void
 trapinit(void)
 {
@@ -67,6 +75,10 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            uvmfault(p->pagetable, r_stval(), r_scause() == 15) == 0){
+    // page fault on a lazily allocated, mmap()ed
+    // or copy-on-write page.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -76,8 +88,9 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // give up the CPU if this is a timer interrupt and the
+  // process's turn is over (see schedtick()).
+  if(which_dev == 2 && schedtick())
     yield();
 
   usertrapret();
@@ -119,8 +132,9 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // tagged with the process's address-space ID.
+  uint64 satp = uvmsatp(p);
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -150,9 +164,13 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // give up the CPU if this is a timer interrupt and the
+  // process's turn is over (see schedtick()).
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING && schedtick()){
+    myproc()->kyield = 1;
     yield();
+    myproc()->kyield = 0;
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -165,10 +183,28 @@ clockintr()
 {
   acquire(&tickslock);
   ticks++;
-  wakeup(&ticks);
+  if(tickarmed && (int)(ticks - tickdue) >= 0){
+    tickarmed = 0;
+    wakeup(&ticks);
+  }
   release(&tickslock);
 }
 
+// Sleep until the tick count reaches deadline, or less: the
+// caller must hold tickslock, and check the count again when
+// this returns. Rather than wake the sleepers on every tick,
+// clockintr() wakes them all when the earliest of their
+// deadlines comes, and those that must sleep on come back.
+void
+tickwait(uint deadline)
+{
+  if(!tickarmed || (int)(deadline - tickdue) < 0){
+    tickdue = deadline;
+    tickarmed = 1;
+  }
+  sleep(&ticks, &tickslock);
+}
+
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
@@ -202,16 +238,21 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or IPI, forwarded by timervec in kernelvec.S.
+
+    // acknowledge the software interrupt by clearing
+    // the SSIP bit in sip. do it first, so that a tick that
+    // comes after the check below raises another one.
+    w_sip(r_sip() & ~2);
+
+    // an IPI only needed to wake this CPU up.
+    if(__atomic_exchange_n(&timer_scratch[cpuid()][5], 0, __ATOMIC_RELAXED) == 0)
+      return 1;
 
     if(cpuid() == 0){
       clockintr();
     }
-    
-    // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
-    w_sip(r_sip() & ~2);
 
     return 2;
   } else {
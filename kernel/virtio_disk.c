@@ -178,7 +178,6 @@ free_desc(int i)
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
   disk.free[i] = 1;
-  wakeup(&disk.free[0]);
 }
 
 // free a chain of descriptors.
@@ -194,6 +193,8 @@ free_chain(int i)
     else
       break;
   }
+  // a chain is three descriptors, enough for one waiter.
+  wakeone(&disk.free[0]);
 }
 
 // allocate three descriptors (they need not be contiguous).
@@ -318,7 +319,7 @@ virtio_disk_intr()
 
     struct buf *b = disk.info[id].b;
     b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    wakeone(b);    // only virtio_disk_rw() waits for it
 
     disk.used_idx += 1;
   }
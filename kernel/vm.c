@@ -5,12 +5,39 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+// address-space IDs for user page tables. the kernel page
+// table uses ASID 0. IDs are handed out in generations: when
+// they run out, a new generation starts, every process gets a
+// new ID the next time it returns to user space, and every
+// hart flushes its whole TLB before using an ID from the new
+// generation. asidmax is 0 if the harts don't implement ASIDs.
+struct spinlock asidlock;
+uint64 asidmax;
+uint64 asidgen = 1;
+uint64 asidnext = 1;
+
+// a page of zeros, mapped read-only and copy-on-write in
+// place of heap and BSS pages that have been read but not
+// yet written (see uvmfault() and uvmzero()). never freed,
+// so its reference count stays above one.
+char *zeropage;
+
+// counts of 2-megabyte superpages that have backed user heap
+// memory, and of superpages split back into 4096-byte pages.
+// updated atomically.
+struct {
+  uint64 promoted;
+  uint64 demoted;
+} superstat;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -21,8 +48,7 @@ kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -33,6 +59,9 @@ kvmmake(void)
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
+  // CLINT's software interrupt registers, for IPIs.
+  kvmmap(kpgtbl, CLINT, CLINT, PGSIZE, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
@@ -54,6 +83,8 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  if((zeropage = kalloc_zeroed()) == 0)
+    panic("kvminit: zeropage");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -70,9 +101,81 @@ kvminithart()
   sfence_vma();
 }
 
+// Find out how many ASID bits the harts implement.
+// Called once, by hart 0, after kvminithart().
+void
+asidinit(void)
+{
+  initlock(&asidlock, "asid");
+
+  // unimplemented ASID bits read back as zero.
+  w_satp(MAKE_SATP_ASID(kernel_pagetable, SATP_ASID_MASK));
+  asidmax = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+  w_satp(MAKE_SATP(kernel_pagetable));
+  sfence_vma();
+}
+
+// Return the satp value that takes p back to user space:
+// its page table, tagged with its ASID. Gives p a new ASID if
+// it has none from the current generation, and flushes what
+// this hart's TLB may hold stale under p's ASID: entries from
+// before p's page table was last changed, and any left from
+// when p last ran here if it has run on another hart since.
+// Called by usertrapret() with interrupts off.
+uint64
+uvmsatp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 gen;
+
+  // without ASIDs, userret and uservec flush the whole TLB.
+  if(asidmax == 0)
+    return MAKE_SATP(p->pagetable);
+
+  acquire(&asidlock);
+  if(p->asidgen != asidgen){
+    if(asidnext > asidmax){
+      asidgen++;
+      asidnext = 1;
+    }
+    p->asid = asidnext++;
+    p->asidgen = asidgen;
+    p->tlbcpu = cpuid();
+  }
+  gen = asidgen;
+  release(&asidlock);
+
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+  } else if(p->tlbflush || p->tlbcpu != cpuid()){
+    sfence_vma_asid(p->asid);
+  }
+  p->tlbflush = 0;
+  p->tlbcpu = cpuid();
+  return MAKE_SATP_ASID(p->pagetable, p->asid);
+}
+
+// Note that the current process's page table has changed,
+// so that uvmsatp() flushes its ASID before the process next
+// runs in user space. Changes to other page tables need no
+// flush: they are new and have never been loaded, or are
+// being freed along with their ASID.
+void
+uvmflush(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p && p->pagetable == pagetable)
+    p->tlbflush = 1;
+}
+
 // Return the address of the PTE in page table pagetable
-// that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// that corresponds to virtual address va, stopping at the
+// level given in *level (0 for a 4096-byte page, 1 for a
+// 2-megabyte superpage). A leaf found at a higher level maps
+// va too; it is returned instead, and *level set to its level.
+// If alloc!=0, create any required page-table pages.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -83,56 +186,90 @@ kvminithart()
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
 pte_t *
-walk(pagetable_t pagetable, uint64 va, int alloc)
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int *level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > *level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)) {
+        *level = l;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(*level, va)];
 }
 
-// Look up a virtual address, return the physical address,
-// or 0 if not mapped.
+// Return the address of the leaf PTE that maps va, or of
+// the level-0 PTE that would, as for walklevel().
+// The leaf may map a superpage; see uvmpromote().
+pte_t *
+walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  int level = 0;
+
+  return walklevel(pagetable, va, alloc, &level);
+}
+
+// Look up a virtual address, return the physical address
+// of its page, or 0 if not mapped.
 // Can only be used to look up user pages.
 uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level = 0;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, 0, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = PTE2PA(*pte) + (va & (PXSIZE(level) - 1) & ~(PGSIZE - 1));
   return pa;
 }
 
-// add a mapping to the kernel page table.
+// add a mapping to the kernel page table, using a superpage
+// for each 2-megabyte-aligned stretch of the range.
 // only used when booting.
 // does not flush TLB or enable paging.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 a, last, n;
+  pte_t *pte;
+  int level;
+
+  a = PGROUNDDOWN(va);
+  last = PGROUNDUP(va + sz);
+  pa = PGROUNDDOWN(pa);
+  for(; a < last; a += n, pa += n){
+    level = 0;
+    n = PGSIZE;
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && last - a >= SUPERPGSIZE){
+      level = 1;
+      n = SUPERPGSIZE;
+    }
+    if((pte = walklevel(kpgtbl, a, 1, &level)) == 0)
+      panic("kvmmap");
+    if(*pte & PTE_V)
+      panic("kvmmap: remap");
+    *pte = PA2PTE(pa) | perm | PTE_V;
+  }
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -161,34 +298,107 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
     a += PGSIZE;
     pa += PGSIZE;
   }
+  uvmflush(pagetable);
   return 0;
 }
 
-// Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
-void
-uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
+// Map the 2-megabyte superpage at pa at va, which must be
+// superpage-aligned and not yet mapped.
+// Returns 0, or -1 if out of memory for a page-table page.
+static int
+mapsuper(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
 {
-  uint64 a;
   pte_t *pte;
+  int level = 1;
 
-  if((va % PGSIZE) != 0)
-    panic("uvmunmap: not aligned");
+  if((pte = walklevel(pagetable, va, 1, &level)) == 0)
+    return -1;
+  if(level != 1 || (*pte & PTE_V))
+    panic("mapsuper: remap");
+  *pte = PA2PTE(pa) | perm | PTE_V;
+  uvmflush(pagetable);
+  return 0;
+}
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
-    if(PTE_FLAGS(*pte) == PTE_V)
+// Remove the mappings of [va, end) from the level-level
+// page-table page pt, which maps the addresses from base on.
+// Descends only into subtrees that exist, and frees the
+// page-table pages whose whole span lies in the range.
+// Returns the number of pages unmapped, not counting mappings
+// of the zero page, which stand for pages not yet allocated.
+static uint64
+unmaprange(pagetable_t pt, int level, uint64 base,
+           uint64 va, uint64 end, int do_free)
+{
+  uint64 lo, hi, n = 0;
+  pagetable_t child;
+  pte_t *pte;
+
+  for(int i = PX(level, va); i <= PX(level, end - 1); i++){
+    pte = &pt[i];
+    if((*pte & PTE_V) == 0){
+      if(*pte & PTE_SWAP){
+        swapfree(*pte);
+        *pte = 0;
+        n++;
+      }
+      continue;
+    }
+    lo = base + i * PXSIZE(level);
+    hi = lo + PXSIZE(level);
+    if(PTE_LEAF(*pte)){
+      // callers split a superpage that they only partly unmap.
+      if(lo < va || hi > end)
+        panic("uvmunmap: superpage");
+      if(do_free){
+        if(level == 0)
+          kfree((void*)PTE2PA(*pte));
+        else
+          kfree_pages((void*)PTE2PA(*pte), SUPERPGORDER);
+      }
+      if(PTE2PA(*pte) != (uint64)zeropage)
+        n += PXSIZE(level) / PGSIZE;
+      *pte = 0;
+    } else if(level == 0){
       panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+    } else {
+      child = (pagetable_t)PTE2PA(*pte);
+      n += unmaprange(child, level - 1, lo,
+                      va > lo ? va : lo, end < hi ? end : hi, do_free);
+      // a page-table page that the range only partly covers
+      // stays, even if empty: growproc() allocated it for
+      // heap pages that are yet to be faulted in.
+      if(va <= lo && hi <= end){
+        kfree(child);
+        *pte = 0;
+      }
     }
-    *pte = 0;
   }
+  return n;
+}
+
+// Remove npages of mappings starting from va. va must be
+// page-aligned. Pages that were never mapped (such as lazily
+// allocated heap pages that were never touched) are skipped.
+// Optionally free the physical memory. Page-table pages that
+// map only addresses in the range are freed as well.
+// Returns the number of pages that were actually unmapped,
+// not counting mappings of the zero page.
+uint64
+uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
+{
+  uint64 n;
+
+  if((va % PGSIZE) != 0)
+    panic("uvmunmap: not aligned");
+  if(npages == 0)
+    return 0;
+  if(va + npages*PGSIZE > MAXVA)
+    panic("uvmunmap: range");
+
+  n = unmaprange(pagetable, 2, 0, va, va + npages*PGSIZE, do_free);
+  uvmflush(pagetable);
+  return n;
 }
 
 // create an empty user page table.
@@ -197,10 +407,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -214,8 +423,7 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -233,12 +441,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -248,6 +455,48 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
   return newsz;
 }
 
+// Allocate the page-table pages needed to map user memory
+// from oldsz to newsz, but map nothing, so that uvmfault()
+// only has to allocate the page itself. Returns 0, or -1 if
+// out of memory (leaving any page-table pages allocated).
+int
+uvmprealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
+{
+  uint64 a;
+
+  // one walk per last-level page table, each of which
+  // maps 512 pages.
+  for(a = PGROUNDUP(oldsz); a < newsz; a = (a | (512*PGSIZE - 1)) + 1){
+    if(walk(pagetable, a, 1) == 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Map the zero page, read-only and copy-on-write, at the pages
+// from oldsz up to newsz, which need not be page aligned, so
+// that the first write to each page gets it a private copy.
+// xperm's PTE_W is ignored. Returns new size or 0 on error.
+uint64
+uvmzero(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
+{
+  uint64 a;
+
+  if(newsz < oldsz)
+    return oldsz;
+
+  oldsz = PGROUNDUP(oldsz);
+  for(a = oldsz; a < newsz; a += PGSIZE){
+    if(mappages(pagetable, a, PGSIZE, (uint64)zeropage,
+                PTE_R|PTE_U|PTE_COW|(xperm & ~PTE_W)) != 0){
+      uvmdealloc(pagetable, a, oldsz);
+      return 0;
+    }
+    kref(zeropage);
+  }
+  return newsz;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -267,7 +516,8 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 }
 
 // Recursively free page-table pages.
-// All leaf mappings must already have been removed.
+// All leaf mappings must already have been removed;
+// uvmunmap() has usually freed most of the tree already.
 void
 freewalk(pagetable_t pagetable)
 {
@@ -298,40 +548,305 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies only the page table: the child shares
+// the parent's physical pages, and writable pages
+// become read-only copy-on-write pages in both,
+// to be copied by uvmcow() on the first write.
+// Pages the parent has not touched yet stay
+// unmapped in the child too, and swapped-out pages
+// share their swap slot.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
-  char *mem;
+  int level;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+    level = 0;
+    if((pte = walklevel(old, i, 0, &level)) == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      // share the swap slot, like a copy-on-write page.
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      *npte = *pte;
+      swapdup(*pte);
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
+    if(level > 0){
+      // share the whole superpage.
+      if(mapsuper(new, i, pa, flags) != 0)
+        goto err;
+      kref_pages((void*)pa, SUPERPGORDER);
+      i += SUPERPGSIZE - PGSIZE;
+      continue;
     }
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
+      goto err;
+    kref((void*)pa);
   }
+  uvmflush(old);
   return 0;
 
  err:
+  uvmflush(old);
   uvmunmap(new, 0, i / PGSIZE, 1);
   return -1;
 }
 
+// Handle a write to the copy-on-write page holding va:
+// give the page table a private, writable copy of the page,
+// or, if nothing else refers to the page any more, just
+// make it writable again. A page merged by ksm.c is
+// un-merged here too. A write to the zero page allocates
+// the page that the process reserved for it.
+// Returns 0 on success, -1 if va is not a copy-on-write
+// page or if out of memory.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+  int level, zero, reclaimed = 0;
+
+  if(va >= MAXVA)
+    return -1;
+again:
+  level = 0;
+  if((pte = walklevel(pagetable, va, 0, &level)) == 0)
+    return -1;
+  if(reclaimed && (*pte & PTE_SWAP))
+    return 0;  // the retried access will swap it back in
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+
+  if(level > 0){
+    // a superpage no one else refers to can simply become
+    // writable; otherwise split it and copy just this page.
+    if(kwhole((void*)pa, SUPERPGORDER) && krefcount((void*)pa) == 1){
+      *pte = PA2PTE(pa) | flags;
+      uvmflush(pagetable);
+      return 0;
+    }
+    if(uvmdemote(pagetable, va) < 0)
+      return -1;
+    pte = walk(pagetable, va, 0);
+    pa = PTE2PA(*pte);
+  }
+
+  if(krefcount((void*)pa) == 1 && ksmprivate((void*)pa)){
+    *pte = PA2PTE(pa) | flags;
+    uvmflush(pagetable);
+    return 0;
+  }
+
+  zero = pa == (uint64)zeropage;
+  if((mem = zero ? kalloc_zeroed() : kalloc()) == 0){
+    // swapreclaim() may swap out this very page, so look
+    // the pte up again once it has made room.
+    if(reclaimed || swapreclaim() == 0)
+      return -1;
+    reclaimed = 1;
+    goto again;
+  }
+  if(!zero)
+    memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  uvmflush(pagetable);
+  kfree((void*)pa);
+  if(zero && p && p->pagetable == pagetable){
+    p->nreserved--;
+    kunreserve(1);
+  }
+  return 0;
+}
+
+// If the 2-megabyte region holding va is lazily allocated
+// heap (below p->sz, outside any mapping, and with none of
+// its pages allocated yet), back the whole region with one
+// zeroed superpage. Returns 0 on success, -1 if the region
+// doesn't qualify or no contiguous block is free, in which
+// case the caller falls back to a single page.
+static int
+uvmpromote(struct proc *p, uint64 va)
+{
+  uint64 a = va - va % SUPERPGSIZE;
+  pagetable_t l0 = 0;
+  struct vma *v;
+  uint64 nblk[MAXORDER+1];
+  pte_t *pte;
+  char *mem;
+  int level = 1, o;
+
+  if(a + SUPERPGSIZE > p->sz)
+    return -1;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end != 0 && v->start < a + SUPERPGSIZE && v->end > a)
+      return -1;
+  }
+
+  // growproc() has usually allocated the level-0 page-table
+  // page already; the superpage replaces it if it is empty.
+  if((pte = walklevel(p->pagetable, a, 1, &level)) == 0 || level != 1)
+    return -1;
+  if(*pte & PTE_V){
+    l0 = (pagetable_t)PTE2PA(*pte);
+    for(int i = 0; i < 512; i++){
+      if(l0[i] != 0)
+        return -1;
+    }
+  }
+
+  // don't make kalloc_pages() drain every free list to
+  // look for a block when the buddy allocator has none.
+  getfreeblocks(nblk);
+  for(o = SUPERPGORDER; o <= MAXORDER && nblk[o] == 0; o++)
+    ;
+  if(o > MAXORDER || (mem = kalloc_pages(SUPERPGORDER)) == 0)
+    return -1;
+  memset(mem, 0, SUPERPGSIZE);
+  *pte = 0;
+  if(l0)
+    kfree(l0);
+  mapsuper(p->pagetable, a, (uint64)mem, PTE_R|PTE_W|PTE_U);
+  p->nreserved -= SUPERPGSIZE / PGSIZE;
+  kunreserve(SUPERPGSIZE / PGSIZE);
+  __sync_fetch_and_add(&superstat.promoted, 1);
+  return 0;
+}
+
+// Split the superpage that maps va, if there is one, into
+// 4096-byte mappings of its pages with the same permissions.
+// Returns 0, or -1 if out of memory for the page-table page.
+int
+uvmdemote(pagetable_t pagetable, uint64 va)
+{
+  pagetable_t l0;
+  pte_t *pte;
+  uint64 pa;
+  int level = 1;
+
+  pte = walklevel(pagetable, va, 0, &level);
+  if(pte == 0 || level != 1 || (*pte & PTE_V) == 0 || !PTE_LEAF(*pte))
+    return 0;
+  if((l0 = (pagetable_t)kalloc_zeroed()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  ksplit((void*)pa, SUPERPGORDER);
+  for(int i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(l0) | PTE_V;
+  uvmflush(pagetable);
+  __sync_fetch_and_add(&superstat.demoted, 1);
+  return 0;
+}
+
+// Report how many superpages have backed user memory and how
+// many of them were split. Takes no lock.
+void
+getsuperstats(uint64 *promoted, uint64 *demoted)
+{
+  *promoted = __atomic_load_n(&superstat.promoted, __ATOMIC_RELAXED);
+  *demoted = __atomic_load_n(&superstat.demoted, __ATOMIC_RELAXED);
+}
+
+// Handle a page fault by the current process at va.
+// A read of an unmapped page below p->sz maps the zero page;
+// a write allocates a zeroed page on demand (growproc() only
+// reserves memory), or a zeroed superpage for a whole
+// untouched region;
+// a page that has been swapped out is read back in, and
+// a write to a copy-on-write page is passed to uvmcow().
+// If memory has run out, cold pages are swapped out to
+// make room (see swap.c).
+// Faults in mmap()ed memory and in lazily loaded program
+// segments are handled by vmafault().
+// Returns 0 if the access can now proceed, -1 if it is
+// invalid or if out of memory.
+int
+uvmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if(p == 0 || p->pagetable != pagetable)
+    return -1;
+  if(vmafind(p, va))
+    return vmafault(p, va, write);
+  if(va >= p->sz)
+    return -1;
+
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(write)
+      return uvmcow(pagetable, va);
+    return -1;
+  }
+  if(pte && (*pte & PTE_SWAP))
+    return swapin(pagetable, va, pte);
+
+  if(!write){
+    // a read needs no page of its own yet; the page stays
+    // reserved until uvmcow() allocates it on the first write.
+    if(mappages(pagetable, va, PGSIZE, (uint64)zeropage, PTE_R|PTE_U|PTE_COW) != 0)
+      return -1;
+    kref(zeropage);
+    return 0;
+  }
+  if(uvmpromote(p, va) == 0)
+    return 0;
+  if((mem = kalloc_zeroed()) == 0 && swapreclaim() > 0)
+    mem = kalloc_zeroed();
+  if(mem == 0)
+    return -1;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  p->nreserved--;
+  kunreserve(1);
+  return 0;
+}
+
+// Fault in the current process's file-backed pages from va
+// to va+len ahead of time, so that copyin() and copyout()
+// won't have to fault them in while the caller holds an inode
+// lock, which the fault might need too.
+// Errors are left for the copy to report.
+void
+uvmprefault(pagetable_t pagetable, uint64 va, uint64 len, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a;
+  pte_t *pte;
+
+  for(a = PGROUNDDOWN(va); a < va + len && a < MAXVA; a += PGSIZE){
+    if((v = vmafind(p, a)) == 0 || v->ip == 0)
+      continue;
+    pte = walk(pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_W) == 0))
+      uvmfault(pagetable, a, write);
+  }
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -345,6 +860,76 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// A translation cache for one copyout(), copyin() or
+// copyinstr() call: the level-0 PTEs (or the superpage PTE)
+// of the 2-megabyte region last looked up, so that a copy
+// walks from the root once per region, not once per page.
+struct ucache {
+  pagetable_t pagetable;
+  uint64 region;  // start of the cached region, or -1
+  pte_t *ptes;    // the region's level-0 PTEs, or 0
+  pte_t *super;   // the region's superpage PTE, or 0
+};
+
+static void
+ucacheinit(struct ucache *c, pagetable_t pagetable)
+{
+  c->pagetable = pagetable;
+  c->region = -1;
+}
+
+// Return the physical address of the user page at va,
+// faulting it in if it is not mapped and, if write is set,
+// making it writable if it is copy-on-write, and marking
+// it accessed (and dirty, if write is set).
+// Returns 0 if va is not accessible user memory.
+static uint64
+ulookup(struct ucache *c, uint64 va, int write)
+{
+  uint64 region = va - va % SUPERPGSIZE;
+  pte_t *pte;
+  int level;
+
+  if(va >= MAXVA)
+    return 0;
+  // unmapped, then read-only copy-on-write, then writable.
+  for(int tries = 0; tries < 3; tries++){
+    if(c->region != region){
+      level = 1;
+      pte = walklevel(c->pagetable, va, 0, &level);
+      c->region = region;
+      c->ptes = c->super = 0;
+      if(pte && (*pte & PTE_V)){
+        if(PTE_LEAF(*pte))
+          c->super = pte;
+        else
+          c->ptes = (pte_t*)PTE2PA(*pte);
+      }
+    }
+    pte = c->super ? c->super : c->ptes ? &c->ptes[PX(0, va)] : 0;
+
+    if(pte && (*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U) &&
+       (!write || (*pte & PTE_W))){
+      // the hardware won't see this access, so mark the page
+      // as it would: vmawriteback() looks for PTE_D.
+      *pte |= write ? PTE_A|PTE_D : PTE_A;
+      if(c->super)
+        return PTE2PA(*pte) + (va - region);
+      return PTE2PA(*pte);
+    }
+
+    // a fault may change the region's page tables.
+    c->region = -1;
+    if(pte && (*pte & PTE_V)){
+      if((*pte & PTE_U) == 0 || !write || uvmcow(c->pagetable, va) < 0)
+        return 0;
+    } else if(uvmfault(c->pagetable, va, write) < 0){
+      return 0;
+    }
+  }
+  return 0;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -352,11 +937,12 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct ucache c;
 
+  ucacheinit(&c, pagetable);
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = ulookup(&c, va0, 1)) == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
     if(n > len)
@@ -377,11 +963,12 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct ucache c;
 
+  ucacheinit(&c, pagetable);
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = ulookup(&c, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -395,6 +982,9 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// does any byte of the 8-byte word w equal zero?
+#define HASZERO(w) (((w) - 0x0101010101010101L) & ~(w) & 0x8080808080808080L)
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
@@ -402,19 +992,36 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
+  uint64 n, va0, pa0, w;
   int got_null = 0;
+  struct ucache c;
 
+  ucacheinit(&c, pagetable);
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = ulookup(&c, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
 
     char *p = (char *) (pa0 + (srcva - va0));
+
+    // copy a word at a time until the word holding the '\0'.
+    while(n >= 8 && ((uint64)p % 8) == 0){
+      w = *(uint64 *)p;
+      if(HASZERO(w))
+        break;
+      if(((uint64)dst % 8) == 0)
+        *(uint64 *)dst = w;
+      else
+        memmove(dst, p, 8);
+      n -= 8;
+      max -= 8;
+      p += 8;
+      dst += 8;
+    }
+
     while(n > 0){
       if(*p == '\0'){
         *dst = '\0';
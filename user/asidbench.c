@@ -0,0 +1,107 @@
+// System call and context switch latency.
+//
+// Times three loops: getpid() alone; getpid() after touching
+// a working set of pages, which costs TLB misses if the trip
+// through the kernel flushed the TLB; and a one-byte ping-pong
+// between two processes over a pair of pipes, which switches
+// address spaces twice per round trip.
+// Compare a kernel whose harts implement ASIDs in satp with
+// one that flushes the whole TLB on every user return.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NCALL 100000
+#define NTOUCH 10000
+#define NPAGES 32
+#define NPING 5000
+
+char pages[NPAGES * PGSIZE];
+
+// print the per-operation cost of n operations that took t ticks.
+void
+report(char *what, int n, int t)
+{
+  if(t < 1)
+    t = 1;
+  // one tick is about 1/10th of a second (see timerinit()).
+  printf("asidbench: %s: %d in %d ticks, %d ns each\n",
+         what, n, t, (int)((uint64)t * 100000000 / n));
+}
+
+void
+syscalls(void)
+{
+  int i, t0;
+
+  t0 = uptime();
+  for(i = 0; i < NCALL; i++)
+    getpid();
+  report("getpid", NCALL, uptime() - t0);
+}
+
+void
+touch(void)
+{
+  int i, j, t0;
+
+  for(j = 0; j < NPAGES; j++)
+    pages[j * PGSIZE] = 1;
+
+  t0 = uptime();
+  for(i = 0; i < NTOUCH; i++){
+    for(j = 0; j < NPAGES; j++)
+      pages[j * PGSIZE]++;
+    getpid();
+  }
+  report("touch+getpid", NTOUCH, uptime() - t0);
+}
+
+void
+pingpong(void)
+{
+  int p1[2], p2[2], i, pid, t0;
+  char c = 0;
+
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    printf("asidbench: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("asidbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p1[1]);
+    close(p2[0]);
+    while(read(p1[0], &c, 1) == 1)
+      write(p2[1], &c, 1);
+    exit(0);
+  }
+  close(p1[0]);
+  close(p2[1]);
+
+  t0 = uptime();
+  for(i = 0; i < NPING; i++){
+    if(write(p1[1], &c, 1) != 1 || read(p2[0], &c, 1) != 1){
+      printf("asidbench: ping-pong failed\n");
+      exit(1);
+    }
+  }
+  report("ping-pong", NPING, uptime() - t0);
+
+  close(p1[1]);
+  close(p2[0]);
+  wait(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  syscalls();
+  touch();
+  pingpong();
+  exit(0);
+}
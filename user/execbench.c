@@ -0,0 +1,112 @@
+// exec() latency and memory benchmark.
+//
+// First, time a series of fork()+exec("sh")s whose shells
+// see end-of-file on their input and exit right away.
+// Then start N shells at once, all waiting for input, and
+// use sysinfo() to see how much memory they hold between
+// them; shells share their text, so each one after the
+// first should cost little more than its data and stack.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define NEXEC 20
+
+char *shargv[] = { "sh", 0 };
+int sink[2];  // shells' output goes here, unread
+
+// fork a shell reading from fd in.
+int
+startsh(int in)
+{
+  int pid = fork();
+  if(pid < 0){
+    printf("execbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    dup(in);
+    close(1);
+    dup(sink[1]);
+    close(2);
+    dup(sink[1]);
+    exec("sh", shargv);
+    printf("execbench: exec sh failed\n");
+    exit(1);
+  }
+  return pid;
+}
+
+void
+latency(void)
+{
+  int fds[2], i, t0, t;
+
+  t0 = uptime();
+  for(i = 0; i < NEXEC; i++){
+    if(pipe(fds) < 0){
+      printf("execbench: pipe failed\n");
+      exit(1);
+    }
+    close(fds[1]);
+    startsh(fds[0]);
+    close(fds[0]);
+    wait(0);
+  }
+  t = uptime() - t0;
+
+  // one tick is about 1/10th of a second (see timerinit()).
+  printf("execbench: %d execs in %d ticks, %d us/exec\n",
+         NEXEC, t, t * 100000 / NEXEC);
+}
+
+void
+resident(int n)
+{
+  struct sysinfo before, after;
+  int fds[2], i;
+  uint64 used;
+
+  if(pipe(fds) < 0){
+    printf("execbench: pipe failed\n");
+    exit(1);
+  }
+  sysinfo(&before);
+  for(i = 0; i < n; i++)
+    startsh(fds[0]);
+  sleep(10);  // let the shells start and block reading
+  sysinfo(&after);
+
+  close(fds[1]);  // end-of-file; the shells exit
+  close(fds[0]);
+  for(i = 0; i < n; i++)
+    wait(0);
+
+  used = before.freemem > after.freemem ? before.freemem - after.freemem : 0;
+  printf("execbench: %d shells hold %d KB, %d KB/shell\n",
+         n, (int)(used / 1024), (int)(used / 1024 / n));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 10;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > NPROC - 4){
+    fprintf(2, "Usage: execbench [nshells]\n");
+    exit(1);
+  }
+  if(pipe(sink) < 0){
+    printf("execbench: pipe failed\n");
+    exit(1);
+  }
+  latency();
+  resident(n);
+  exit(0);
+}
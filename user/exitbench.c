@@ -0,0 +1,73 @@
+// exit() cost of a large process.
+//
+// A child grows its heap a page at a time (so that it is
+// mapped with 4096-byte pages, not superpages), touches every
+// page, tells the parent it is ready, and exits. The parent
+// times from the child's signal until wait() returns, which
+// is mostly the kernel tearing down the child's page table.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NROUND 10
+
+// return the ticks a child with mb megabytes takes to exit.
+int
+onexit(int mb)
+{
+  int fds[2], pid, t0;
+  uint64 i, npages = (uint64)mb * 1024 * 1024 / PGSIZE;
+  char *p, c;
+
+  if(pipe(fds) < 0){
+    printf("exitbench: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("exitbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < npages; i++){
+      p = sbrk(PGSIZE);
+      if(p == (char*)0xffffffffffffffffL){
+        printf("exitbench: sbrk failed\n");
+        exit(1);
+      }
+      *p = 1;
+    }
+    write(fds[1], "x", 1);
+    exit(0);
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 1){
+    printf("exitbench: child failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  wait(0);
+  close(fds[0]);
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 64, i, t = 0;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb < 1){
+    fprintf(2, "Usage: exitbench [megabytes]\n");
+    exit(1);
+  }
+  for(i = 0; i < NROUND; i++)
+    t += onexit(mb);
+  // one tick is about 1/10th of a second (see timerinit()).
+  printf("exitbench: %d MB process: %d exits in %d ticks, %d us/exit\n",
+         mb, NROUND, t, t * 100000 / NROUND);
+  exit(0);
+}
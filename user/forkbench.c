@@ -0,0 +1,60 @@
+// fork() latency benchmark.
+//
+// For each parent size, grow the heap to that size, touch
+// every page so it is really allocated, and then time a
+// series of fork()s whose children exit immediately.
+// Prints the average cost of fork() + exit() + wait().
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NFORK 50
+
+int
+bench(int mb)
+{
+  char *a, *p;
+  int i, t0, t;
+  uint64 sz = (uint64)mb * 1024 * 1024;
+
+  a = sbrk(sz);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("forkbench: sbrk %d MB failed\n", mb);
+    return -1;
+  }
+  for(p = a; p < a + sz; p += PGSIZE)
+    *p = 1;
+
+  t0 = uptime();
+  for(i = 0; i < NFORK; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("forkbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+  t = uptime() - t0;
+
+  // one tick is about 1/10th of a second (see timerinit()).
+  printf("forkbench: %d MB parent: %d forks in %d ticks, %d us/fork\n",
+         mb, NFORK, t, t * 100000 / NFORK);
+  sbrk(-sz);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc > 1){
+    for(int i = 1; i < argc; i++)
+      bench(atoi(argv[i]));
+  } else {
+    bench(1);
+    bench(16);
+  }
+  exit(0);
+}
@@ -0,0 +1,98 @@
+// Physical page allocator throughput benchmark.
+//
+// For 1..N concurrent allocators, fork that many children;
+// each one repeatedly grows its heap by a batch of pages,
+// touches every page, and shrinks it again, so every page
+// goes through kalloc() and kfree(). Prints the aggregate
+// pages/sec for each level of concurrency.
+//
+// Run under different CPUS= settings, e.g.
+//   make CPUS=1 qemu    and    make CPUS=8 qemu
+// then "kallocbench 8" to see how allocation scales.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define BATCH   64    // pages per sbrk
+#define ROUNDS  200   // sbrk rounds per child
+
+// grow and shrink the heap ROUNDS times; returns pages allocated.
+int
+churn(void)
+{
+  char *a, *p;
+  int i, n = 0;
+
+  for(i = 0; i < ROUNDS; i++){
+    a = sbrk(BATCH*PGSIZE);
+    if(a == (char*)0xffffffffffffffffL)
+      break;
+    for(p = a; p < a + BATCH*PGSIZE; p += PGSIZE)
+      *p = 1;
+    n += BATCH;
+    sbrk(-(BATCH*PGSIZE));
+  }
+  return n;
+}
+
+// run nproc allocators at once; returns elapsed ticks and
+// stores the total number of pages allocated in *pages.
+int
+run(int nproc, int *pages)
+{
+  int fds[2], i, n, total, t0;
+
+  if(pipe(fds) < 0){
+    printf("kallocbench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("kallocbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      n = churn();
+      write(fds[1], &n, sizeof(n));
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  total = 0;
+  while(read(fds[0], &n, sizeof(n)) == sizeof(n))
+    total += n;
+  close(fds[0]);
+  for(i = 0; i < nproc; i++)
+    wait(0);
+  *pages = total;
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxproc = 8;
+  int nproc, pages, ticks;
+
+  if(argc > 1)
+    maxproc = atoi(argv[1]);
+  if(maxproc < 1){
+    fprintf(2, "Usage: kallocbench [maxproc]\n");
+    exit(1);
+  }
+
+  printf("kallocbench: %d pages x %d rounds per allocator\n", BATCH, ROUNDS);
+  for(nproc = 1; nproc <= maxproc; nproc++){
+    ticks = run(nproc, &pages);
+    if(ticks < 1)
+      ticks = 1;
+    // one tick is about 1/10th of a second (see timerinit()).
+    printf("kallocbench: %d allocators: %d pages in %d ticks, %d pages/sec\n",
+           nproc, pages, ticks, pages * 10 / ticks);
+  }
+  exit(0);
+}
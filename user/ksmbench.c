@@ -0,0 +1,96 @@
+// Same-page merging.
+//
+// Start N children that each fill the same number of heap
+// pages with the same contents (half of them zeros), then
+// wait, watching sysinfo(), for ksmd to merge the pages.
+// Then have the children write to every page, which must
+// un-merge it, and check that each child sees only its own
+// writes.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define NCHILD 4
+#define NPAGES 64
+#define NWAIT  30   // seconds to wait for merging
+
+int
+main(int argc, char *argv[])
+{
+  int go[2], done[2], i, j, pid[NCHILD], t, ok = 1, xstatus;
+  struct sysinfo before, after;
+  char *a, c;
+
+  if(pipe(go) < 0 || pipe(done) < 0){
+    printf("ksmbench: pipe failed\n");
+    exit(1);
+  }
+  sysinfo(&before);
+  for(i = 0; i < NCHILD; i++){
+    if((pid[i] = fork()) < 0){
+      printf("ksmbench: fork failed\n");
+      exit(1);
+    }
+    if(pid[i] == 0){
+      // grow a page at a time, so that the heap isn't
+      // mapped with superpages, which aren't merged.
+      for(j = 0; j < NPAGES; j++){
+        if((a = sbrk(PGSIZE)) == (char*)0xffffffffffffffffL){
+          printf("ksmbench: sbrk failed\n");
+          exit(1);
+        }
+        if(j % 2)
+          memset(a, j, PGSIZE);
+        else
+          a[0] = 0; // touch it, so that it is allocated
+      }
+      a -= (NPAGES - 1) * PGSIZE;
+      write(done[1], "x", 1);
+      if(read(go[0], &c, 1) != 1)
+        exit(1);
+      for(j = 0; j < NPAGES; j++)
+        a[j * PGSIZE + i] = 'A' + i;
+      for(j = 0; j < NPAGES; j++){
+        for(int k = 0; k < NCHILD; k++){
+          if(a[j * PGSIZE + k] != (k == i ? 'A' + i : (j % 2 ? j : 0))){
+            printf("ksmbench: child %d sees another's write\n", i);
+            exit(1);
+          }
+        }
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++)
+    read(done[0], &c, 1);
+
+  // one tick is about 1/10th of a second (see timerinit()).
+  for(t = 0; t < NWAIT; t++){
+    sleep(10);
+    sysinfo(&after);
+    if((long)(after.ksmsaved - before.ksmsaved) >= (NCHILD - 1) * NPAGES * PGSIZE / 2)
+      break;
+  }
+  printf("ksmbench: after %d s: %d pages merged, %d KB saved\n",
+         t, (int)(after.ksmmerged - before.ksmmerged),
+         (int)((long)(after.ksmsaved - before.ksmsaved) / 1024));
+
+  for(i = 0; i < NCHILD; i++)
+    write(go[1], "x", 1);
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      ok = 0;
+  }
+  sysinfo(&after);
+  printf("ksmbench: after writes: %d KB saved\n",
+         (int)((long)(after.ksmsaved - before.ksmsaved) / 1024));
+  if(!ok){
+    printf("ksmbench: FAILED\n");
+    exit(1);
+  }
+  exit(0);
+}
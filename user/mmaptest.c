@@ -0,0 +1,338 @@
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define MAP_FAILED ((char *) -1)
+
+char *testname = "???";
+
+void
+err(char *why)
+{
+  printf("mmaptest: %s failed: %s, pid=%d\n", testname, why, getpid());
+  exit(1);
+}
+
+// make a file of 2.5 pages: page 0 all 'A', page 1 all 'B',
+// and half of page 2 all 'C'.
+void
+makefile(const char *f)
+{
+  char buf[PGSIZE];
+  int fd, i;
+
+  unlink(f);
+  fd = open(f, O_WRONLY | O_CREATE);
+  if(fd < 0)
+    err("open");
+  for(i = 0; i < 3; i++){
+    memset(buf, 'A' + i, PGSIZE);
+    if(write(fd, buf, i < 2 ? PGSIZE : PGSIZE/2) != (i < 2 ? PGSIZE : PGSIZE/2))
+      err("write");
+  }
+  close(fd);
+}
+
+// check that the 2.5-page image at p matches makefile(),
+// with zeroes after the end of the file.
+void
+checkimage(char *p)
+{
+  int i;
+
+  for(i = 0; i < PGSIZE*5/2; i++){
+    if(p[i] != 'A' + i/PGSIZE)
+      err("bad file contents");
+  }
+  for(; i < 3*PGSIZE; i++){
+    if(p[i] != 0)
+      err("not zero past end of file");
+  }
+}
+
+void
+private_test(void)
+{
+  const char *f = "mmap.dur";
+  char *p;
+  int fd;
+
+  testname = "private";
+  makefile(f);
+  if((fd = open(f, O_RDONLY)) < 0)
+    err("open");
+  p = mmap(0, 3*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  close(fd);
+  checkimage(p);
+
+  // private writes must not reach the file.
+  p[0] = 'Z';
+  if(munmap(p, 3*PGSIZE) != 0)
+    err("munmap");
+
+  if((fd = open(f, O_RDONLY)) < 0)
+    err("open");
+  p = mmap(0, 3*PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  close(fd);
+  checkimage(p);
+  munmap(p, 3*PGSIZE);
+  printf("%s: OK\n", testname);
+}
+
+void
+shared_test(void)
+{
+  const char *f = "mmap.dur";
+  char *p, buf[2];
+  int fd, i;
+
+  testname = "shared";
+  makefile(f);
+
+  // a read-only file can't be mapped shared and writable.
+  if((fd = open(f, O_RDONLY)) < 0)
+    err("open");
+  if(mmap(0, 3*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED)
+    err("mmap of read-only file");
+  close(fd);
+
+  if((fd = open(f, O_RDWR)) < 0)
+    err("open");
+  p = mmap(0, 3*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  checkimage(p);
+
+  // write the first two pages, and the last byte of the
+  // mapping, which is past the end of the file.
+  for(i = 0; i < 2*PGSIZE; i++)
+    p[i] = 'Z';
+  p[3*PGSIZE - 1] = 'Z';
+  if(munmap(p, PGSIZE) != 0)
+    err("munmap first page");
+  if(read(fd, buf, 1) != 1 || buf[0] != 'Z')
+    err("first page not written back");
+  if(munmap(p + PGSIZE, 2*PGSIZE) != 0)
+    err("munmap rest");
+
+  // writes past the end of the file must not extend it.
+  struct stat st;
+  if(fstat(fd, &st) < 0 || st.size != PGSIZE*5/2)
+    err("file size changed");
+  close(fd);
+
+  if((fd = open(f, O_RDONLY)) < 0)
+    err("open");
+  for(i = 0; i < 2*PGSIZE; i++){
+    if(read(fd, buf, 1) != 1 || buf[0] != 'Z')
+      err("shared write lost");
+  }
+  close(fd);
+  unlink(f);
+  printf("%s: OK\n", testname);
+}
+
+void
+hole_test(void)
+{
+  char *p;
+  int i, pid, xstatus;
+
+  testname = "hole";
+  p = mmap(0, 4*PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  for(i = 0; i < 4*PGSIZE; i++){
+    if(p[i] != 0)
+      err("anonymous memory not zero");
+    p[i] = i;
+  }
+
+  // unmap the middle two pages.
+  if(munmap(p + PGSIZE, 2*PGSIZE) != 0)
+    err("munmap");
+  if(p[0] != 0 || p[3*PGSIZE + 1] != (char)(3*PGSIZE + 1))
+    err("wrong contents after munmap");
+
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    p[PGSIZE] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1)
+    err("access to unmapped page not killed");
+
+  if(munmap(p, 4*PGSIZE) != 0)
+    err("munmap all");
+  printf("%s: OK\n", testname);
+}
+
+void
+fork_test(void)
+{
+  char *priv, *shared;
+  int pid, xstatus;
+
+  testname = "fork";
+  priv = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  shared = mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(priv == MAP_FAILED || shared == MAP_FAILED)
+    err("mmap");
+  priv[0] = 1;
+  shared[0] = 1;
+
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    if(priv[0] != 1 || shared[0] != 1)
+      err("child sees wrong contents");
+    priv[0] = 2;
+    shared[0] = 2;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(priv[0] != 1)
+    err("child's private write visible");
+  if(shared[0] != 2)
+    err("child's shared write not visible");
+  munmap(priv, PGSIZE);
+  munmap(shared, PGSIZE);
+  printf("%s: OK\n", testname);
+}
+
+// shared pages first touched after fork() must be shared too,
+// for both anonymous and file mappings.
+void
+forkwrite_test(void)
+{
+  const char *f = "mmap.dur";
+  static char buf[PGSIZE];
+  char *anon, *file, c;
+  int fd, pid, xstatus, pfd[2];
+
+  testname = "forkwrite";
+  makefile(f);
+  if((fd = open(f, O_RDWR)) < 0)
+    err("open");
+  file = mmap(0, 2*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  anon = mmap(0, 2*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(file == MAP_FAILED || anon == MAP_FAILED)
+    err("mmap");
+  close(fd);
+  if(pipe(pfd) < 0)
+    err("pipe");
+
+  pid = fork();
+  if(pid < 0)
+    err("fork");
+  if(pid == 0){
+    anon[0] = 'c';
+    file[0] = 'c';
+    if(read(pfd[0], &c, 1) != 1)
+      err("read");
+    if(anon[PGSIZE] != 'p' || file[PGSIZE] != 'p')
+      err("parent's write not visible");
+    exit(0);
+  }
+  anon[PGSIZE] = 'p';
+  file[PGSIZE] = 'p';
+  write(pfd[1], "x", 1);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(anon[0] != 'c' || file[0] != 'c')
+    err("child's write not visible");
+  close(pfd[0]);
+  close(pfd[1]);
+  if(munmap(anon, 2*PGSIZE) != 0 || munmap(file, 2*PGSIZE) != 0)
+    err("munmap");
+
+  // both writes reach the file.
+  if((fd = open(f, O_RDONLY)) < 0)
+    err("open");
+  if(read(fd, buf, PGSIZE) != PGSIZE || buf[0] != 'c')
+    err("child's write lost");
+  if(read(fd, buf, PGSIZE) != PGSIZE || buf[0] != 'p')
+    err("parent's write lost");
+  close(fd);
+  unlink(f);
+  printf("%s: OK\n", testname);
+}
+
+// the kernel writes into a shared mapping, as read() does,
+// must reach the file as well.
+void
+kwrite_test(void)
+{
+  const char *f = "mmap.dur", *src = "mmap.src";
+  static char buf[PGSIZE];
+  char *p;
+  int fd, i;
+
+  testname = "kwrite";
+  makefile(f);
+  unlink(src);
+  if((fd = open(src, O_WRONLY | O_CREATE)) < 0)
+    err("open");
+  memset(buf, 'K', PGSIZE);
+  if(write(fd, buf, PGSIZE) != PGSIZE)
+    err("write");
+  close(fd);
+
+  if((fd = open(f, O_RDWR)) < 0)
+    err("open");
+  p = mmap(0, 2*PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap");
+  close(fd);
+  // fault the first page in by reading it, so that only the
+  // kernel's write can have made it dirty.
+  if(p[0] != 'A')
+    err("bad file contents");
+  if((fd = open(src, O_RDONLY)) < 0)
+    err("open");
+  if(read(fd, p, PGSIZE) != PGSIZE || read(fd, p + PGSIZE, 1) != 0)
+    err("read into mapping");
+  close(fd);
+  if(munmap(p, 2*PGSIZE) != 0)
+    err("munmap");
+
+  if((fd = open(f, O_RDONLY)) < 0)
+    err("open");
+  if(read(fd, buf, PGSIZE) != PGSIZE)
+    err("read");
+  for(i = 0; i < PGSIZE; i++){
+    if(buf[i] != 'K')
+      err("kernel's write lost");
+  }
+  close(fd);
+  unlink(f);
+  unlink(src);
+  printf("%s: OK\n", testname);
+}
+
+int
+main(int argc, char *argv[])
+{
+  private_test();
+  shared_test();
+  hole_test();
+  fork_test();
+  forkwrite_test();
+  kwrite_test();
+  printf("mmaptest: all tests succeeded\n");
+  exit(0);
+}
@@ -0,0 +1,84 @@
+// Interactive response under CPU load.
+//
+// Starts N CPU-bound children, then, as an interactive
+// process would, repeatedly sleeps for a tick and does a
+// little work: it prints the average and worst number of
+// ticks past the one it asked to sleep for before it ran
+// again, and the time to fork and wait for a batch of
+// short-lived children. With -n, the CPU-bound children
+// nice() themselves first.
+// Compare a kernel built with "make SCHED=MLFQ" against the
+// default round robin one, with "make qemu CPUS=1".
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define NROUND 50
+#define NSHORT 20
+
+int
+main(int argc, char *argv[])
+{
+  int nhog = 4, benice = 0, i, t0, t, late, total = 0, worst = 0;
+  int pid[NPROC];
+
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-n") == 0)
+      benice = 1;
+    else
+      nhog = atoi(argv[i]);
+  }
+  if(nhog < 0 || nhog > NPROC - 4 - 1){
+    fprintf(2, "Usage: respbench [-n] [nhogs]\n");
+    exit(1);
+  }
+
+  for(i = 0; i < nhog; i++){
+    if((pid[i] = fork()) < 0){
+      printf("respbench: fork failed\n");
+      exit(1);
+    }
+    if(pid[i] == 0){
+      if(benice)
+        nice(NICEMAX);
+      for(volatile uint64 x = 0; ; x++)
+        ;
+    }
+  }
+  sleep(2); // let the hogs use up their quanta
+
+  for(i = 0; i < NROUND; i++){
+    t0 = uptime();
+    sleep(1);
+    late = uptime() - t0 - 1;
+    total += late;
+    if(late > worst)
+      worst = late;
+  }
+
+  t0 = uptime();
+  for(i = 0; i < NSHORT; i++){
+    int p = fork();
+    if(p < 0){
+      printf("respbench: fork failed\n");
+      break;
+    }
+    if(p == 0)
+      exit(0);
+    wait(0);
+  }
+  t = uptime() - t0;
+
+  for(i = 0; i < nhog; i++)
+    kill(pid[i]);
+  for(i = 0; i < nhog; i++)
+    wait(0);
+
+  // one tick is about 1/10th of a second (see timerinit()).
+  printf("respbench: %d hogs%s: wakeup late by %d.%d ticks on average, "
+         "%d at worst; %d forks in %d ticks\n",
+         nhog, benice ? " (niced)" : "", total / NROUND,
+         (total % NROUND) * 10 / NROUND, worst, NSHORT, t);
+  exit(0);
+}
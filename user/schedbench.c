@@ -0,0 +1,124 @@
+// Context switch throughput as the number of CPUs grows.
+//
+// Runs pairs of processes that pass a byte back and forth over
+// a pair of pipes, so that every round trip is two sleeps and
+// two wakeups, and prints round trips per second. With -p,
+// each pair is pinned with setaffinity() to one CPU. With -x,
+// the two sides of each pair are pinned to different CPUs, so
+// that every wakeup is of a process on another CPU, which is
+// idle and must be sent an IPI; the time per round trip is
+// then about twice the wakeup latency.
+// Run it under "make qemu CPUS=n" for n = 1 to 8 to see how
+// the scheduler scales, and watch qemu in top on the host to
+// see how much CPU time idle CPUs use.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define NROUND 2000
+
+// count the CPUs that are running, by asking to run on each.
+int
+countcpus(void)
+{
+  int i, n = 0;
+
+  for(i = 0; i < NCPU; i++){
+    if(setaffinity(getpid(), 1L << i) == 0)
+      n++;
+  }
+  setaffinity(getpid(), ~0L);
+  return n;
+}
+
+// fork a pair of processes that ping-pong NROUND times,
+// one on the CPUs in mask0 and the other on those in mask1.
+void
+pair(uint64 mask0, uint64 mask1)
+{
+  int p1[2], p2[2], i;
+  char c = 0;
+
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  for(int side = 0; side < 2; side++){
+    int pid = fork();
+    if(pid < 0){
+      printf("schedbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      setaffinity(getpid(), side == 0 ? mask0 : mask1);
+      for(i = 0; i < NROUND; i++){
+        if(side == 0){
+          if(write(p1[1], &c, 1) != 1 || read(p2[0], &c, 1) != 1)
+            exit(1);
+        } else {
+          if(read(p1[0], &c, 1) != 1 || write(p2[1], &c, 1) != 1)
+            exit(1);
+        }
+      }
+      exit(0);
+    }
+  }
+  close(p1[0]);
+  close(p1[1]);
+  close(p2[0]);
+  close(p2[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int npairs = 4, pin = 0, cross = 0, ncpu, i, t0, t, xstatus, ok = 1;
+
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-p") == 0)
+      pin = 1;
+    else if(strcmp(argv[i], "-x") == 0)
+      cross = 1;
+    else
+      npairs = atoi(argv[i]);
+  }
+  if(npairs < 1 || 2 * npairs > NPROC - 4){
+    fprintf(2, "Usage: schedbench [-p | -x] [npairs]\n");
+    exit(1);
+  }
+  ncpu = countcpus();
+  if(cross && ncpu < 2){
+    fprintf(2, "schedbench: -x needs at least 2 CPUs\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < npairs; i++){
+    if(cross)
+      pair(1L << (2*i % ncpu), 1L << ((2*i + 1) % ncpu));
+    else if(pin)
+      pair(1L << (i % ncpu), 1L << (i % ncpu));
+    else
+      pair(~0L, ~0L);
+  }
+  for(i = 0; i < 2 * npairs; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      ok = 0;
+  }
+  t = uptime() - t0;
+  if(!ok){
+    printf("schedbench: a ping-pong failed\n");
+    exit(1);
+  }
+  if(t < 1)
+    t = 1;
+  // one tick is about 1/10th of a second (see timerinit()).
+  printf("schedbench: %d CPUs, %d pairs%s: %d round trips in %d ticks, "
+         "%d/sec, %d us each\n",
+         ncpu, npairs, cross ? " (split)" : pin ? " (pinned)" : "",
+         npairs * NROUND, t, npairs * NROUND * 10 / t,
+         t * 100000 / NROUND);
+  exit(0);
+}
@@ -3,6 +3,7 @@
 #include "kernel/types.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -53,6 +54,7 @@ int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
 void runcmd(struct cmd*) __attribute__((noreturn));
+int spawncmd(char*);
 
 // Execute cmd.  Never returns.
 void
@@ -165,6 +167,8 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    if(spawncmd(buf) == 0)
+      continue;
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait(0);
@@ -446,6 +450,160 @@ parseexec(char **ps, char *es)
   return ret;
 }
 
+//PAGEBREAK!
+// Spawning
+
+#define MAXREDIR 3  // redirections per spawned command
+
+// Is s a pipeline of one or more commands, each just words
+// and at most MAXREDIR redirections, that parsecmd() will
+// accept without complaint?
+int
+simplepipe(char *s)
+{
+  char *es;
+  int tok, nargs, nredir;
+
+  es = s + strlen(s);
+  nargs = nredir = 0;
+  for(;;){
+    tok = gettoken(&s, es, 0, 0);
+    if(tok == 'a'){
+      if(++nargs >= MAXARGS)
+        return 0;
+    } else if(tok == '<' || tok == '>' || tok == '+'){
+      if(++nredir > MAXREDIR || gettoken(&s, es, 0, 0) != 'a')
+        return 0;
+    } else if(tok == '|' || tok == 0){
+      if(nargs == 0)
+        return 0;
+      if(tok == 0)
+        return 1;
+      nargs = nredir = 0;
+    } else {
+      return 0;
+    }
+  }
+}
+
+// Append a file action for each of cmd's redirections to
+// act[*n], and return the command being redirected.
+// The outermost redirection goes first, as in runcmd().
+struct execcmd*
+rediracts(struct cmd *cmd, struct spawnact *act, int *n)
+{
+  struct redircmd *rcmd;
+
+  while(cmd->type == REDIR){
+    rcmd = (struct redircmd*)cmd;
+    act[*n].op = SPAWN_OPEN;
+    act[*n].fd = rcmd->fd;
+    act[*n].arg = rcmd->mode;
+    act[*n].path = rcmd->file;
+    (*n)++;
+    cmd = rcmd->cmd;
+  }
+  return (struct execcmd*)cmd;
+}
+
+void
+addact(struct spawnact *act, int *n, int op, int fd, int arg)
+{
+  act[*n].op = op;
+  act[*n].fd = fd;
+  act[*n].arg = arg;
+  act[*n].path = 0;
+  (*n)++;
+}
+
+// Free a command parsed by parsecmd() in the shell itself.
+void
+freecmd(struct cmd *cmd)
+{
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
+
+// Run buf with spawn() if it is a simple pipeline, so that
+// the shell's memory isn't copied only to be thrown away by
+// exec(), and wait for it. Returns -1, having done nothing,
+// if buf needs fork1() and runcmd().
+int
+spawncmd(char *buf)
+{
+  struct spawnact act[NSPAWNACT+1];
+  struct cmd *cmd, *next;
+  struct execcmd *ecmd;
+  int p[2], in, n, nproc;
+
+  if(!simplepipe(buf))
+    return -1;
+  cmd = parsecmd(buf);
+
+  in = -1;
+  nproc = 0;
+  for(next = cmd; next; ){
+    struct cmd *c = next;
+    next = 0;
+    if(c->type == PIPE){
+      next = ((struct pipecmd*)c)->right;
+      c = ((struct pipecmd*)c)->left;
+    }
+
+    // connect the pipes first, then redirect, as runcmd() does.
+    n = 0;
+    p[0] = p[1] = -1;
+    if(in >= 0){
+      addact(act, &n, SPAWN_DUP, 0, in);
+      addact(act, &n, SPAWN_CLOSE, in, 0);
+    }
+    if(next){
+      if(pipe(p) < 0){
+        fprintf(2, "pipe failed\n");
+        break;
+      }
+      addact(act, &n, SPAWN_DUP, 1, p[1]);
+      addact(act, &n, SPAWN_CLOSE, p[0], 0);
+      addact(act, &n, SPAWN_CLOSE, p[1], 0);
+    }
+    ecmd = rediracts(c, act, &n);
+    act[n].op = SPAWN_END;
+
+    if(spawn(ecmd->argv[0], ecmd->argv, act) < 0)
+      fprintf(2, "spawn %s failed\n", ecmd->argv[0]);
+    else
+      nproc++;
+
+    if(in >= 0)
+      close(in);
+    if(p[1] >= 0)
+      close(p[1]);
+    in = p[0];
+  }
+  if(in >= 0)
+    close(in);
+
+  while(nproc-- > 0)
+    wait(0);
+  freecmd(cmd);
+  return 0;
+}
+
 // NUL-terminate all the counted strings.
 struct cmd*
 nulterminate(struct cmd *cmd)
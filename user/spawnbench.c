@@ -0,0 +1,84 @@
+// Command launch rate: fork()+exec() versus spawn().
+//
+// For each parent size, grow the heap to that size and touch
+// every page, as a long-running shell might, then launch a
+// series of children that exit at once, first with fork() and
+// exec() and then with spawn(). Prints launches per second.
+// The child is this program, run as "spawnbench -x".
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/spawn.h"
+#include "user/user.h"
+
+#define NLAUNCH 50
+
+char *xargv[] = { "spawnbench", "-x", 0 };
+
+int
+launch(int usespawn)
+{
+  int i, pid, t0;
+
+  t0 = uptime();
+  for(i = 0; i < NLAUNCH; i++){
+    if(usespawn){
+      pid = spawn(xargv[0], xargv, 0);
+    } else {
+      pid = fork();
+      if(pid == 0){
+        exec(xargv[0], xargv);
+        exit(1);
+      }
+    }
+    if(pid < 0){
+      printf("spawnbench: launch failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  return uptime() - t0;
+}
+
+void
+bench(int mb)
+{
+  char *a, *p;
+  int tfork, tspawn;
+  uint64 sz = (uint64)mb * 1024 * 1024;
+
+  a = sbrk(sz);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("spawnbench: sbrk %d MB failed\n", mb);
+    return;
+  }
+  for(p = a; p < a + sz; p += PGSIZE)
+    *p = 1;
+
+  tfork = launch(0);
+  tspawn = launch(1);
+  if(tfork < 1)
+    tfork = 1;
+  if(tspawn < 1)
+    tspawn = 1;
+  // one tick is about 1/10th of a second (see timerinit()).
+  printf("spawnbench: %d MB parent: fork+exec %d/sec, spawn %d/sec\n",
+         mb, NLAUNCH * 10 / tfork, NLAUNCH * 10 / tspawn);
+  sbrk(-sz);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+
+  if(argc > 1){
+    for(int i = 1; i < argc; i++)
+      bench(atoi(argv[i]));
+  } else {
+    bench(0);
+    bench(8);
+  }
+  exit(0);
+}
@@ -0,0 +1,112 @@
+// Test that stride scheduling shares a CPU in proportion to
+// tickets. Starts CPU-bound children with different numbers
+// of tickets, all pinned to CPU 0, lets them run for NTICKS
+// ticks, and checks that each one's share of the work done
+// is within a few percent of its share of the tickets.
+// Run it on a kernel built with "make SCHED=STRIDE".
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define NTICKS 100
+#define SLACK  5     // percent
+
+int tickets[] = { 100, 200, 300 };
+#define NCHILD (sizeof(tickets) / sizeof(tickets[0]))
+
+// spin until the deadline, counting, and report the count.
+void
+child(int go, int out, int i)
+{
+  uint64 n = 0;
+  int deadline;
+
+  if(settickets(tickets[i]) < 0 || setaffinity(getpid(), 1) < 0){
+    printf("stridetest: settickets or setaffinity failed\n");
+    exit(1);
+  }
+  if(read(go, &deadline, sizeof(deadline)) != sizeof(deadline))
+    exit(1);
+  for(;;){
+    for(volatile int j = 0; j < 10000; j++)
+      ;
+    n++;
+    if(uptime() >= deadline)
+      break;
+  }
+  write(out, &n, sizeof(n));
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int go[2], out[2], i, deadline, totaltickets = 0, ok = 1;
+  uint64 n[NCHILD], total = 0;
+
+  if(pipe(go) < 0 || pipe(out) < 0){
+    printf("stridetest: pipe failed\n");
+    exit(1);
+  }
+  if(settickets(0) != -1 || settickets(MAXTICKETS + 1) != -1){
+    printf("stridetest: settickets accepted a bad count\n");
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("stridetest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      child(go[0], out[1], i);
+    totaltickets += tickets[i];
+  }
+  sleep(1); // let them all pin themselves
+
+  deadline = uptime() + NTICKS;
+  for(i = 0; i < NCHILD; i++)
+    write(go[1], &deadline, sizeof(deadline));
+  for(i = 0; i < NCHILD; i++){
+    int xstatus;
+    wait(&xstatus);
+    if(xstatus != 0)
+      ok = 0;
+  }
+  // the counts arrive in no particular order; since tickets[]
+  // is in increasing order, match them up by size.
+  for(i = 0; i < NCHILD; i++){
+    if(read(out[0], &n[i], sizeof(n[i])) != sizeof(n[i]))
+      ok = 0;
+  }
+  if(!ok){
+    printf("stridetest: a child failed\n");
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    for(int j = i + 1; j < NCHILD; j++){
+      if(n[j] < n[i]){
+        uint64 t = n[i];
+        n[i] = n[j];
+        n[j] = t;
+      }
+    }
+    total += n[i];
+  }
+
+  for(i = 0; i < NCHILD; i++){
+    int want = tickets[i] * 1000 / totaltickets;
+    int got = n[i] * 1000 / total;
+    printf("stridetest: %d tickets: %d.%d%% of the CPU, expected %d.%d%%\n",
+           tickets[i], got / 10, got % 10, want / 10, want % 10);
+    if(got < want - want * SLACK / 100 || got > want + want * SLACK / 100)
+      ok = 0;
+  }
+  if(!ok){
+    printf("stridetest: FAILED\n");
+    exit(1);
+  }
+  printf("stridetest: OK\n");
+  exit(0);
+}
@@ -1,4 +1,5 @@
 #include "kernel/types.h"
+#include "kernel/param.h"
 #include "kernel/riscv.h"
 #include "kernel/sysinfo.h"
 #include "user/user.h"
@@ -120,6 +121,24 @@ void testproc() {
   }
 }
 
+// the free buddy blocks can't add up to more than
+// the free memory.
+void testfrag() {
+  struct sysinfo info;
+  uint64 blkmem;
+  int o;
+
+  sinfo(&info);
+  blkmem = 0;
+  for(o = 0; o <= MAXORDER; o++)
+    blkmem += (info.freeblocks[o] << o) * PGSIZE;
+  if(blkmem > info.freemem){
+    printf("sysinfotest: FAIL free blocks hold %d bytes but freemem is %d\n",
+           blkmem, info.freemem);
+    exit(1);
+  }
+}
+
 void testbad() {
   int pid = fork();
   int xstatus;
@@ -148,6 +167,7 @@ main(int argc, char *argv[])
   testcall();
   testmem();
   testproc();
+  testfrag();
   printf("sysinfotest: OK\n");
   exit(0);
 }
@@ -1,5 +1,6 @@
 struct stat;
 struct sysinfo;
+struct spawnact;
 
 // system calls
 int fork(void);
@@ -25,6 +26,12 @@ int sleep(int);
 int uptime(void);
 int trace(int); // (HW1-1) trace system call
 int sysinfo(struct sysinfo *);
+void *mmap(void *, uint64, int, int, int, uint64);
+int munmap(void *, uint64);
+int spawn(const char *, char **, struct spawnact *);
+int setaffinity(int, uint64);
+int nice(int);
+int settickets(int);
 
 // ulib.c
 int stat(const char *, struct stat *);
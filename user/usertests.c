@@ -7,6 +7,8 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/spawn.h"
+#include "kernel/sysinfo.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -730,6 +732,77 @@ exectest(char *s)
 
 }
 
+// spawn() with file actions: redirect echo's output to a
+// file, through a pipe, and check that bad spawns fail.
+void
+spawntest(char *s)
+{
+  int fd, fds[2], xstatus;
+  char *echoargv[] = { "echo", "OK", 0 };
+  struct spawnact act[4];
+  char buf[3];
+
+  unlink("echo-ok");
+  act[0].op = SPAWN_OPEN;
+  act[0].fd = 1;
+  act[0].arg = O_CREATE|O_WRONLY;
+  act[0].path = "echo-ok";
+  act[1].op = SPAWN_END;
+  if(spawn("echo", echoargv, act) < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  fd = open("echo-ok", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 2) != 2 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output in file\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("echo-ok");
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  act[0].op = SPAWN_DUP;
+  act[0].fd = 1;
+  act[0].arg = fds[1];
+  act[1].op = SPAWN_CLOSE;
+  act[1].fd = fds[0];
+  act[2].op = SPAWN_CLOSE;
+  act[2].fd = fds[1];
+  act[3].op = SPAWN_END;
+  if(spawn("echo", echoargv, act) < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  if(read(fds[0], buf, 2) != 2 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output in pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  if(spawn("nosuchprogram", echoargv, 0) >= 0){
+    printf("%s: spawn of missing program succeeded\n", s);
+    exit(1);
+  }
+  act[0].op = SPAWN_DUP;
+  act[0].fd = 1;
+  act[0].arg = NOFILE - 1;
+  act[1].op = SPAWN_END;
+  if(spawn("echo", echoargv, act) >= 0){
+    printf("%s: spawn with bad file action succeeded\n", s);
+    exit(1);
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -2117,6 +2190,161 @@ sbrkmuch(char *s)
   }
 }
 
+// sbrk() allocates pages lazily. do system calls, fork(),
+// and shrinking work with pages that were never touched?
+void
+lazysbrk(char *s)
+{
+  enum { N=10 };
+  char *a, *b;
+  int fds[2], pid, xstatus;
+
+  a = sbrk(N*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a[0] = 1;
+
+  // copyout() into an untouched page.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "xyz", 3) != 3){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  b = a + 3*PGSIZE + 100;
+  if(read(fds[0], b, 3) != 3 || b[0] != 'x' || b[2] != 'z'){
+    printf("%s: read into untouched page failed\n", s);
+    exit(1);
+  }
+
+  // copyin() from an untouched page, which reads as zeroes.
+  b = a + 5*PGSIZE;
+  if(write(fds[1], b, 2) != 2){
+    printf("%s: write from untouched page failed\n", s);
+    exit(1);
+  }
+  b = a + 3*PGSIZE;
+  if(read(fds[0], b, 2) != 2 || b[0] != 0 || b[1] != 0){
+    printf("%s: untouched page is not zero\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  // the child inherits the untouched pages.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(b = a; b < a + N*PGSIZE; b += PGSIZE){
+      if(b != a && b != a + 3*PGSIZE && *b != 0){
+        printf("%s: child sees non-zero page\n", s);
+        exit(1);
+      }
+      *b = 2;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(a[0] != 1 || a[7*PGSIZE] != 0){
+    printf("%s: child's writes are visible to parent\n", s);
+    exit(1);
+  }
+
+  // shrink over a mix of touched and untouched pages.
+  if(sbrk(-(N*PGSIZE)) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+}
+
+// heap memory in untouched 2-megabyte-aligned regions may be
+// backed by superpages. do copy-on-write fork, copyout(), and
+// shrinking into the middle of one work?
+void
+superpage(char *s)
+{
+  char *a, *b, *top;
+  int fds[2], pid, xstatus;
+  uint64 pad;
+
+  top = sbrk(0);
+  pad = SUPERPGSIZE - (uint64)top % SUPERPGSIZE;
+  if(sbrk(pad + 2*SUPERPGSIZE) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = top + pad;
+  for(b = a; b < a + 2*SUPERPGSIZE; b += PGSIZE){
+    if(*b != 0){
+      printf("%s: new heap not zero\n", s);
+      exit(1);
+    }
+    *b = (b - a) / PGSIZE;
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a[PGSIZE] = 99;
+    for(b = a; b < a + 2*SUPERPGSIZE; b += PGSIZE){
+      if(b != a + PGSIZE && *b != (char)((b - a) / PGSIZE)){
+        printf("%s: child sees wrong contents\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(a[PGSIZE] != 1){
+    printf("%s: child's write is visible to parent\n", s);
+    exit(1);
+  }
+
+  // copyout() into the middle of the region.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  b = a + SUPERPGSIZE - 1;
+  if(write(fds[1], "xy", 2) != 2 || read(fds[0], b, 2) != 2 ||
+     b[0] != 'x' || b[1] != 'y'){
+    printf("%s: read into heap failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  // cut the first region in half.
+  if(sbrk(-(SUPERPGSIZE + SUPERPGSIZE/2)) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  for(b = a + PGSIZE*2; b < a + SUPERPGSIZE/2; b += PGSIZE){
+    if(*b != (char)((b - a) / PGSIZE)){
+      printf("%s: contents lost by shrink\n", s);
+      exit(1);
+    }
+  }
+  if(sbrk(-(pad + SUPERPGSIZE/2)) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2294,6 +2522,72 @@ bsstest(char *s)
   }
 }
 
+// reading BSS or heap pages that have never been written
+// should cost no memory: they all map one page of zeros.
+// writes must still give each page, and each process, a
+// private copy.
+char zeroes[64*4096];
+void
+zeropagetest(char *s)
+{
+  struct sysinfo before, after;
+  int i, sum = 0, pid, xstatus;
+  char *a;
+
+  // grow a page at a time, so that the heap isn't
+  // mapped with superpages.
+  a = sbrk(0);
+  for(i = 0; i < 64; i++){
+    if(sbrk(PGSIZE) == (char*)0xffffffffffffffffL){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+  }
+
+  sysinfo(&before);
+  for(i = 0; i < 64; i++)
+    sum += zeroes[i * PGSIZE] + a[i * PGSIZE];
+  sysinfo(&after);
+  if(sum != 0){
+    printf("%s: untouched memory isn't zero\n", s);
+    exit(1);
+  }
+  if((long)(before.freemem - after.freemem) > 16 * PGSIZE){
+    printf("%s: reading 128 pages took %d pages of memory\n", s,
+           (int)((before.freemem - after.freemem) / PGSIZE));
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < 64; i++){
+      zeroes[i * PGSIZE] = i + 1;
+      a[i * PGSIZE] = i + 1;
+    }
+    for(i = 0; i < 64; i++){
+      if(zeroes[i * PGSIZE] != i + 1 || a[i * PGSIZE] != i + 1){
+        printf("%s: write lost\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  for(i = 0; i < 64; i++){
+    if(zeroes[i * PGSIZE] != 0 || a[i * PGSIZE] != 0){
+      printf("%s: child's write is visible to parent\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-64 * PGSIZE);
+}
+
 // does exec return an error if the arguments
 // are larger than a page? or does it write
 // below the stack and wreck the instructions/data?
@@ -2593,6 +2887,7 @@ struct test {
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
+  {spawntest, "spawntest"},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
@@ -2620,12 +2915,15 @@ struct test {
   {forktest, "forktest"},
   {sbrkbasic, "sbrkbasic"},
   {sbrkmuch, "sbrkmuch"},
+  {lazysbrk, "lazysbrk"},
+  {superpage, "superpage"},
   {kernmem, "kernmem"},
   {MAXVAplus, "MAXVAplus"},
   {sbrkfail, "sbrkfail"},
   {sbrkarg, "sbrkarg"},
   {validatetest, "validatetest"},
   {bsstest, "bsstest"},
+  {zeropagetest, "zeropagetest"},
   {bigargtest, "bigargtest"},
   {argptest, "argptest"},
   {stacktest, "stacktest"},
@@ -2924,6 +3222,50 @@ outofinodes(char *s)
   }
 }
 
+// use more memory than there is RAM, so that the kernel has
+// to swap pages out, and check that they come back intact,
+// both when touched and when read() or write() uses them.
+void
+swapout(char *s)
+{
+  char *a, *p, *top;
+  int fds[2];
+
+  // grow a page at a time, so that the heap isn't
+  // mapped with superpages, which are never swapped.
+  top = sbrk(0);
+  for(a = top; (p = sbrk(PGSIZE)) != (char*)0xffffffffffffffffL; a += PGSIZE)
+    *(uint64*)p = (uint64)p;
+  if(a == top){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+
+  for(p = top; p < a; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: page at %p lost its contents\n", s, p);
+      exit(1);
+    }
+  }
+
+  // the first pages are the coldest, and so likely on disk.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], top, 8) != 8 || read(fds[0], top + PGSIZE, 8) != 8){
+    printf("%s: pipe I/O failed\n", s);
+    exit(1);
+  }
+  if(*(uint64*)(top + PGSIZE) != (uint64)top){
+    printf("%s: read wrong data\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-(a - top));
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2931,6 +3273,7 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {swapout, "swapout"},
     
   { 0, 0},
 };
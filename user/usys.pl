@@ -38,4 +38,10 @@ entry("sleep");
 entry("uptime");
 entry("trace");  # (HW1-1) add trace syscall stub
 entry("sysinfo");
+entry("mmap");
+entry("munmap");
+entry("spawn");
+entry("setaffinity");
+entry("nice");
+entry("settickets");
 